@@ -0,0 +1,70 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every configuration is a complete path-counter built with its own N, BITS and mode, whose main
+// was renamed and whose other symbols were made local (see the multi target in the Makefile)
+#define CONFIG(n, bits, mode) int path_counter_##n##_##bits##_##mode(int argc, char *argv[]);
+#include "configs.h"
+#undef CONFIG
+
+typedef struct {
+    int n;
+    int bits;
+    const char *mode;
+    int (*main)(int argc, char *argv[]);
+} config_t;
+
+#define CONFIG(n, bits, mode) {n, bits, #mode, path_counter_##n##_##bits##_##mode},
+static const config_t configs[] = {
+#include "configs.h"
+};
+#undef CONFIG
+
+#define CONFIG_CNT ((int)(sizeof(configs) / sizeof(configs[0])))
+
+void list_configs() {
+    for (int i = 0; i < CONFIG_CNT; i++) {
+        printf("%d %d %s\n", configs[i].n, configs[i].bits, configs[i].mode);
+    }
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s <n> <bits> <paths|cycles|hamiltonian> [path-counter arguments]\n",
+            name);
+    fprintf(stderr, "       %s --list\n\n", name);
+    fprintf(stderr, "available configurations:\n");
+    for (int i = 0; i < CONFIG_CNT; i++) {
+        fprintf(stderr, "  %d %d %s\n", configs[i].n, configs[i].bits, configs[i].mode);
+    }
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "--list") == 0) {
+        list_configs();
+        return 0;
+    }
+    if (argc < 4) {
+        usage(argv[0]);
+    }
+
+    int n = atoi(argv[1]);
+    int bits = atoi(argv[2]);
+    for (int i = 0; i < CONFIG_CNT; i++) {
+        if (configs[i].n == n && configs[i].bits == bits && strcmp(configs[i].mode, argv[3]) == 0) {
+            // The selected configuration sees the remaining arguments as its own command line
+            argv[3] = argv[0];
+            return configs[i].main(argc - 3, argv + 3);
+        }
+    }
+
+    fprintf(stderr, "configuration %d %d %s is not built in\n\n", n, bits, argv[3]);
+    usage(argv[0]);
+}
@@ -33,6 +33,7 @@ MODS = {
 }
 
 COMMAND = 'path-counter'
+MULTI_COMMAND = 'path-counter-multi'
 if ARGV.length < 3
   puts "usage: n bits threads [cycles | hamiltonian]"
   return
@@ -49,9 +50,16 @@ if n < 4 || n > 30
   return
 end
 
-# compile
-`make N=#{n} BITS=#{bits} CYCLES=#{cycles ? 1 : 0} HAMILTONIAN=#{hamiltonian ? 1 : 0} N_THREADS=#{threads}`
-raise 'compile error' unless $?.success?
+# use a configuration built into path-counter-multi, or compile
+mode = hamiltonian ? 'hamiltonian' : cycles ? 'cycles' : 'paths'
+multi = "./#{MULTI_COMMAND}"
+if File.executable?(multi) && `#{multi} --list`.lines.include?("#{n} #{bits} #{mode}\n")
+  command = "#{multi} #{n} #{bits} #{mode} --threads #{threads}"
+else
+  `make N=#{n} BITS=#{bits} CYCLES=#{cycles ? 1 : 0} HAMILTONIAN=#{hamiltonian ? 1 : 0} N_THREADS=#{threads}`
+  raise 'compile error' unless $?.success?
+  command = "./#{COMMAND} --threads #{threads}"
+end
 
 ##########################################
 
@@ -85,10 +93,13 @@ used_mods = []
 current_result = 0
 final_result = 0
 
-MODS[bits].each_with_index do |mod, i|
+# bit-sliced builds (bits 2 to 7) take the 8-bit primes below 2^bits
+mods = bits < 8 ? MODS[8].select { |mod| mod < 2**bits } : MODS[bits]
+
+mods.each_with_index do |mod, i|
   last_line = ""
   buffer = ""
-  IO.popen("./#{COMMAND} #{mod}", "r") do |io|
+  IO.popen("#{command} #{mod}", "r") do |io|
     io.each_char do |char|
       print char
       $stdout.flush
@@ -68,40 +68,103 @@ uint64_t replace_right_hi(uint64_t state, int col) {
     return s ? state : set_state_value(state, i + 1, RIGHT);
 }
 
-void process_group(const grid_context_t *context, counter_t mod, int col, uint32_t group) {
+int is_last_row_completable(uint64_t state) {
+    int match[N], stack[N], sp = 0, ends = 0;
+
+    // Every vertex of the last row has to be covered by horizontal edges alone, so the cuts
+    // pair up into adjacent segments, each joining two path ends
+    for (int i = 0; i < N; i++) {
+        uint64_t v = state_value(state, i);
+        if (v == BLANK) {
+            if (ends % 2 == 0) {
+                return 0;
+            }
+            continue;
+        }
+
+        if (v == LEFT) {
+            stack[sp++] = ends;
+        } else if (sp > 0) {
+            int j = stack[--sp];
+            match[j] = ends;
+            match[ends] = j;
+        }
+        ends++;
+    }
+    if (ends % 2 != 0) {
+        return 0;
+    }
+
+    // The segments have to join all paths into a single cycle
+    int visited = 0, e = 0;
+    do {
+        e = match[e ^ 1];
+        visited += 2;
+    } while (e != 0);
+
+    return visited == ends;
+}
+
+// A zero first counter stands for its whole bucket only on the full grid, sparse (Hamiltonian or
+// obstructed) counts check the bucket and its blocked counterpart. Without the edge between col
+// and col + 1 only the blocked counterparts are taken over. States with a cut in one of the
+// positions of cut are zero, and so are their blocked counterparts, so whole hi states and buckets
+// with one are skipped.
+void process_group(const grid_context_t *context, counter_t mod, int col, uint32_t group,
+                   int sparse, int edge, uint64_t cut) {
     uint64_t mask = (1ULL << ((col + 1) << I_SHIFT)) - 1;
     uint32_t states_lo_col = col < N_LO ? col : N_LO - 1;
+    uint64_t cut_lo = cut & CUTS_MASK_LO & ~((1ULL << (states_lo_col << I_SHIFT)) - 1);
 
     const uint32_t *g_ptr = group_ptr(context, col, group);
     uint32_t g_cnt = context->group_cnt[GROUP_BUCKET(col)][group];
+    uint64_t states_done = 0;
 
     for (uint32_t g = 0; g < g_cnt; g++) {
         uint32_t state_hi_index = g_ptr[g];
         uint64_t state_hi = context->states_hi[state_hi_index];
         uint64_t state_hi_shifted = state_hi << SHIFT_N_LO;
+        if (state_hi_shifted & cut) {
+            continue;
+        }
 
         uint32_t hi_cnt = context->hi_cnt_lookup[state_hi_index];
         const uint32_t *states_lo_ptr = context->state_lo_buckets[states_lo_col][hi_cnt];
         uint32_t states_lo_cnt = context->state_lo_buckets_cnt[states_lo_col][hi_cnt];
 
+        // An empty list has no first state to address the counters with
+        if (states_lo_cnt == 0) {
+            continue;
+        }
         const uint32_t *state_lo_buckets_size_ptr =
             context->state_lo_buckets_size[states_lo_col][hi_cnt];
-        counter_t *counters_ptr = counters_main_ptr(context, state_hi_shifted | *states_lo_ptr);
-        counter_t *counters_ptr_start = counters_ptr;
+        counter_ptr_t counters_ptr = counters_main_ptr(context, state_hi_shifted | *states_lo_ptr);
+        counter_ptr_t counters_ptr_start = counters_ptr;
 
         uint32_t bucket_size;
         for (uint32_t i = 0; i < states_lo_cnt; i++, counters_ptr += bucket_size) {
             bucket_size = state_lo_buckets_size_ptr[i];
 
-            if (!HAMILTONIAN && *counters_ptr == 0) {
+            if ((!sparse && get_counter(counters_ptr) == 0) || (states_lo_ptr[i] & cut_lo)) {
                 continue;
             }
 
             uint64_t state = state_hi_shifted | states_lo_ptr[i];
             uint64_t pair = state_pair(state, col);
 
-            if (HAMILTONIAN && bucket_size == 1 && *counters_ptr == 0 &&
-                (pair >> VALUE_SHIFT) != BLANK) {
+            // Sparse counts scan the bucket once; a zero BLANK bucket still takes over its blocked
+            // counterpart below
+            int zero = sparse && is_zero(counters_ptr, bucket_size);
+            if (zero && (pair >> VALUE_SHIFT) != BLANK) {
+                continue;
+            }
+            states_done += bucket_size;
+
+            if (!edge) {
+                if ((pair >> VALUE_SHIFT) == BLANK) {
+                    add_mod_reset(bucket_size, counters_ptr,
+                                  counters_blocked_ptr(context, shift_state(state, mask)), mod);
+                }
                 continue;
             }
 
@@ -109,7 +172,13 @@ void process_group(const grid_context_t *context, counter_t mod, int col, uint32
 
             if ((pair >> VALUE_SHIFT) == BLANK) {
                 uint64_t shifted_state = shift_state(state, mask);
-                counter_t *blocked_ptr = counters_blocked_ptr(context, shifted_state);
+                counter_ptr_t blocked_ptr = counters_blocked_ptr(context, shifted_state);
+
+                // A Hamiltonian state takes over its blocked counterpart, so it can be skipped
+                // only when both are zero
+                if (zero && is_zero(blocked_ptr, bucket_size)) {
+                    continue;
+                }
 
                 if (pair == PAIR(BLANK, BLANK)) {
                     add_mod_twice(bucket_size, counters_ptr, counters_main_ptr(context, new_state),
@@ -127,7 +196,7 @@ void process_group(const grid_context_t *context, counter_t mod, int col, uint32
                 }
 
                 uint64_t shifted_state = shift_state(new_state, mask);
-                counter_t *blocked_ptr = counters_blocked_ptr(context, shifted_state);
+                counter_ptr_t blocked_ptr = counters_blocked_ptr(context, shifted_state);
 
                 add_mod(bucket_size, blocked_ptr, counters_ptr, mod);
 
@@ -137,7 +206,7 @@ void process_group(const grid_context_t *context, counter_t mod, int col, uint32
 
                     if (new_state_replaced != new_state) {
                         uint64_t shifted_state = shift_state(new_state_replaced, mask);
-                        counter_t *blocked_ptr = counters_blocked_ptr(context, shifted_state);
+                        counter_ptr_t blocked_ptr = counters_blocked_ptr(context, shifted_state);
 
                         add_mod(bucket_size, blocked_ptr, counters_ptr, mod);
                         continue;
@@ -147,7 +216,7 @@ void process_group(const grid_context_t *context, counter_t mod, int col, uint32
                 const uint32_t *lo_ptr =
                     &context->states_lo[hi_cnt][counters_ptr - counters_ptr_start];
                 for (uint32_t j = 0; j < bucket_size; j++) {
-                    if (counters_ptr[j]) {
+                    if (get_counter(counters_ptr + j)) {
                         state = state_hi_shifted | lo_ptr[j];
                         pair = state_pair(state, col);
 
@@ -155,18 +224,51 @@ void process_group(const grid_context_t *context, counter_t mod, int col, uint32
                         new_state = replace_right(context->replace_right_lookup, new_state, col);
 
                         uint64_t shifted_state = shift_state(new_state, mask);
-                        counter_t *blocked_ptr = counters_blocked_ptr(context, shifted_state);
+                        counter_ptr_t blocked_ptr = counters_blocked_ptr(context, shifted_state);
                         _add_mod(blocked_ptr, counters_ptr + j, mod);
                     }
                 }
             }
         }
     }
+    t_states_done += states_done;
 }
 
-void process_group_for_col0(const grid_context_t *context, counter_t mod, uint32_t group) {
+void merge_blocked(const grid_context_t *context, counter_t mod, uint32_t state_hi_index) {
+    uint64_t state_hi = context->states_hi[state_hi_index];
+    uint64_t state_hi_shifted = state_hi << SHIFT_N_LO;
+
+    uint32_t hi_cnt = context->hi_cnt_lookup[state_hi_index];
+    uint32_t states_lo_cnt = context->states_lo_cnt[hi_cnt];
+    const uint32_t *states_lo_ptr = context->states_lo[hi_cnt];
+
+    uint32_t i = 0;
+    while (i < states_lo_cnt && (states_lo_ptr[i] & VALUE_MASK) != BLANK) {
+        i++;
+    }
+    if (i == states_lo_cnt) {
+        return;
+    }
+
+    uint64_t state = state_hi_shifted | states_lo_ptr[i];
+    counter_ptr_t counters_ptr = counters_main_ptr(context, state);
+    counter_ptr_t blocked_ptr = counters_blocked_ptr(context, state >> VALUE_SHIFT);
+
+    while (i < states_lo_cnt) {
+        if ((states_lo_ptr[i] & VALUE_MASK) == BLANK) {
+            _add_mod_reset(counters_ptr, blocked_ptr, mod);
+            blocked_ptr++;
+        }
+        counters_ptr++;
+        i++;
+    }
+}
+
+void process_group_for_col0(const grid_context_t *context, counter_t mod, uint32_t group,
+                            int sparse, int edge) {
     const uint32_t *g_ptr = group_ptr(context, 0, group);
     uint32_t g_cnt = context->group_cnt[0][group];
+    uint64_t states_done = 0;
 
     for (uint32_t g = 0; g < g_cnt; g++) {
         uint64_t state_hi = context->states_hi[g_ptr[g]];
@@ -176,8 +278,11 @@ void process_group_for_col0(const grid_context_t *context, counter_t mod, uint32
         uint32_t states_lo_cnt = context->states_lo_cnt[hi_cnt];
         const uint32_t *states_lo_ptr = context->state_lo_buckets[0][hi_cnt];
 
-        counter_t *counters_ptr = counters_main_ptr(context, state_hi_shifted | *states_lo_ptr);
-        counter_t *blocked_ptr = NULL;
+        if (states_lo_cnt == 0) {
+            continue;
+        }
+        counter_ptr_t counters_ptr = counters_main_ptr(context, state_hi_shifted | *states_lo_ptr);
+        counter_ptr_t blocked_ptr = 0;
 
         for (uint32_t i = 0; i < states_lo_cnt; i++) {
             if ((states_lo_ptr[i] & VALUE_MASK) == BLANK) {
@@ -188,7 +293,8 @@ void process_group_for_col0(const grid_context_t *context, counter_t mod, uint32
         }
 
         for (uint32_t i = 0; i < states_lo_cnt; i++, counters_ptr++) {
-            if (!HAMILTONIAN && *counters_ptr == 0) {
+            int zero = get_counter(counters_ptr) == 0;
+            if (!sparse && zero) {
                 if (blocked_ptr && (states_lo_ptr[i] & VALUE_MASK) == BLANK) {
                     _add_mod_reset(counters_ptr, blocked_ptr, mod);
                     blocked_ptr++;
@@ -199,13 +305,22 @@ void process_group_for_col0(const grid_context_t *context, counter_t mod, uint32
             uint64_t state = state_hi_shifted | states_lo_ptr[i];
             uint64_t pair = state & PAIR_MASK;
 
-            if (HAMILTONIAN && *counters_ptr == 0 && (pair >> VALUE_SHIFT) != BLANK) {
+            if (HAMILTONIAN && zero && (pair >> VALUE_SHIFT) != BLANK) {
                 continue;
             }
+            states_done++;
 
             if ((pair >> VALUE_SHIFT) == BLANK) {
-                if (pair == PAIR(BLANK, BLANK)) {
-                    counter_t *counters_new_ptr = counters_ptr + (CYCLES ? 1 : 2);
+                if (!edge) {
+                    _add_mod_reset(counters_ptr, blocked_ptr, mod);
+                    if (pair != PAIR(BLANK, BLANK)) {
+                        counters_ptr++;
+                        i++;
+                    }
+                    blocked_ptr++;
+
+                } else if (pair == PAIR(BLANK, BLANK)) {
+                    counter_ptr_t counters_new_ptr = counters_ptr + (CYCLES ? 1 : 2);
                     _add_mod_twice(counters_ptr, counters_new_ptr, blocked_ptr, mod);
                     blocked_ptr++;
 
@@ -223,17 +338,26 @@ void process_group_for_col0(const grid_context_t *context, counter_t mod, uint32
                 }
 
             } else if (!HAMILTONIAN && (pair & VALUE_MASK) == BLANK) {
-                _add_mod(counters_ptr - 1, counters_ptr, mod);
+                if (edge) {
+                    _add_mod(counters_ptr - 1, counters_ptr, mod);
+                }
                 _add_mod_reset(counters_ptr, blocked_ptr, mod);
                 blocked_ptr++;
 
-            } else if ((pair >> VALUE_SHIFT) == LEFT) {
+            } else if ((pair >> VALUE_SHIFT) == LEFT && edge) {
                 uint64_t new_state = set_state_pair(state, 0, replace_pairs[pair]);
                 if (pair == PAIR(LEFT, LEFT)) {
                     new_state = replace_left(context->replace_left_lookup, new_state, 0);
                 }
 
-                counter_t *blocked_new_ptr =
+                // replace_left only lowers the state, so a target outside this hi state belongs
+                // to one processed earlier in the group, whose blocked states are merged already
+                if (HAMILTONIAN && (new_state >> SHIFT_N_LO) != state_hi) {
+                    _add_mod(counters_main_ptr(context, new_state), counters_ptr, mod);
+                    continue;
+                }
+
+                counter_ptr_t blocked_new_ptr =
                     counters_blocked_ptr(context, new_state >> VALUE_SHIFT);
                 _add_mod(blocked_new_ptr, counters_ptr, mod);
 
@@ -242,52 +366,98 @@ void process_group_for_col0(const grid_context_t *context, counter_t mod, uint32
                 }
             }
         }
+
+        // Hamiltonian blocked states replace their main states, merged in the same pass
+        if (HAMILTONIAN) {
+            merge_blocked(context, mod, g_ptr[g]);
+        }
     }
+    t_states_done += states_done;
 }
 
-void merge_blocked(const grid_context_t *context, counter_t mod, uint32_t group) {
-    const uint32_t *g_ptr = group_ptr(context, 0, group);
-    uint32_t g_cnt = context->group_cnt[0][group];
+void prune_group_task(const grid_context_t *context, counter_t mod, int row, int col,
+                      uint32_t group) {
+    const uint32_t *g_ptr = group_ptr(context, col, group);
+    uint32_t g_cnt = group_cnt(context, col, group);
 
     for (uint32_t g = 0; g < g_cnt; g++) {
-        uint32_t state_hi_index = g_ptr[g];
-        uint64_t state_hi = context->states_hi[state_hi_index];
-        uint64_t state_hi_shifted = state_hi << SHIFT_N_LO;
+        uint64_t state_hi_shifted = (uint64_t)context->states_hi[g_ptr[g]] << SHIFT_N_LO;
 
-        uint32_t hi_cnt = context->hi_cnt_lookup[state_hi_index];
+        uint32_t hi_cnt = context->hi_cnt_lookup[g_ptr[g]];
         uint32_t states_lo_cnt = context->states_lo_cnt[hi_cnt];
         const uint32_t *states_lo_ptr = context->states_lo[hi_cnt];
 
-        uint32_t i = 0;
-        while (i < states_lo_cnt && (states_lo_ptr[i] & VALUE_MASK) != BLANK) {
-            i++;
-        }
-        if (i == states_lo_cnt) {
+        if (states_lo_cnt == 0) {
             continue;
         }
+        counter_ptr_t counters_ptr = counters_main_ptr(context, state_hi_shifted | *states_lo_ptr);
+        for (uint32_t i = 0; i < states_lo_cnt; i++, counters_ptr++) {
+            if (get_counter(counters_ptr) &&
+                !is_last_row_completable(state_hi_shifted | states_lo_ptr[i])) {
+                clear_counter(counters_ptr);
+            }
+        }
+    }
+}
 
-        uint64_t state = state_hi_shifted | states_lo_ptr[i];
-        counter_t *counters_ptr = counters_main_ptr(context, state);
-        counter_t *blocked_ptr = counters_blocked_ptr(context, state >> VALUE_SHIFT);
+void mask_group_task(const grid_context_t *context, counter_t mod, int row, int col,
+                     uint32_t group) {
+    const uint32_t *g_ptr = group_ptr(context, col, group);
+    uint32_t g_cnt = group_cnt(context, col, group);
+    uint64_t cut = context->obstacle_cut[row];
 
-        while (i < states_lo_cnt) {
-            if ((states_lo_ptr[i] & VALUE_MASK) == BLANK) {
-                _add_mod_reset(counters_ptr, blocked_ptr, mod);
-                blocked_ptr++;
+    for (uint32_t g = 0; g < g_cnt; g++) {
+        uint64_t state_hi_shifted = (uint64_t)context->states_hi[g_ptr[g]] << SHIFT_N_LO;
+
+        uint32_t hi_cnt = context->hi_cnt_lookup[g_ptr[g]];
+        uint32_t states_lo_cnt = context->states_lo_cnt[hi_cnt];
+        const uint32_t *states_lo_ptr = context->states_lo[hi_cnt];
+
+        if (states_lo_cnt == 0) {
+            continue;
+        }
+        counter_ptr_t counters_ptr = counters_main_ptr(context, state_hi_shifted | *states_lo_ptr);
+        for (uint32_t i = 0; i < states_lo_cnt; i++, counters_ptr++) {
+            if (get_counter(counters_ptr) && ((state_hi_shifted | states_lo_ptr[i]) & cut)) {
+                clear_counter(counters_ptr);
             }
-            counters_ptr++;
-            i++;
         }
     }
 }
 
-void run_group_task(const grid_context_t *context, counter_t mod, int col, uint32_t group) {
-    if (col == 0) {
-        process_group_for_col0(context, mod, group);
-        if (HAMILTONIAN) {
-            merge_blocked(context, mod, group);
+// The full grid gets its own copies of the kernels: flattening inlines them with constant
+// arguments, so the sparse, edge and cut checks are folded away
+__attribute__((flatten)) void process_full_group(const grid_context_t *context, counter_t mod,
+                                                 int col, uint32_t group) {
+    process_group(context, mod, col, group, HAMILTONIAN, 1, 0);
+}
+
+__attribute__((flatten)) void process_full_group_for_col0(const grid_context_t *context,
+                                                          counter_t mod, uint32_t group) {
+    process_group_for_col0(context, mod, group, HAMILTONIAN, 1);
+}
+
+void run_group_task(const grid_context_t *context, counter_t mod, int row, int col,
+                    uint32_t group) {
+    if (!context->obstacles) {
+        if (col == 0) {
+            process_full_group_for_col0(context, mod, group);
+        } else {
+            process_full_group(context, mod, col, group);
         }
+        return;
+    }
+
+    // Positions that can't hold a cut in this cell: up to col a cut still enters the row from above,
+    // past col + 1 it already leaves the row from one of its vertices
+    uint64_t above = (1ULL << ((col + 1) << I_SHIFT)) - 1;
+    uint64_t below = ~((1ULL << ((col + 2) << I_SHIFT)) - 1);
+    uint64_t cut = (context->obstacle_cut[row] & above) | (context->obstacle_vertices[row] & below);
+
+    int edge = has_edge(context, row, col);
+    if (col == 0) {
+        process_group_for_col0(context, mod, group, 1, edge);
     } else {
-        process_group(context, mod, col, group);
+        process_group(context, mod, col, group, 1, edge, cut);
     }
 }
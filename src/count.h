@@ -6,4 +6,8 @@
 
 #include "defs.h"
 
-void run_group_task(const grid_context_t *, counter_t, int, uint32_t);
+typedef void (*group_task_t)(const grid_context_t *, counter_t, int, int, uint32_t);
+
+void run_group_task(const grid_context_t *, counter_t, int, int, uint32_t);
+void prune_group_task(const grid_context_t *, counter_t, int, int, uint32_t);
+void mask_group_task(const grid_context_t *, counter_t, int, int, uint32_t);
@@ -0,0 +1,334 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crt.h"
+#include "report.h"
+
+#define MODS_CNT(mods) ((int)(sizeof(mods) / sizeof(mods[0])))
+
+// Same primes as run.rb, the largest ones first
+const uint64_t mods_8[] = {
+    251, 241, 239, 233, 229, 227, 223, 211, 199, 197, 193, 191, 181, 179,
+    173, 167, 163, 157, 151, 149, 139, 137, 131, 127, 113, 109, 107, 103,
+    101, 97,  89,  83,  79,  73,  71,  67,  61,  59,  53,  47,  43,  41,
+    37,  31,  29,  23,  19,  17,  13,  11,  7,   5,   3,   2,
+};
+
+const uint64_t mods_16[] = {
+    65521, 65519, 65497, 65479, 65449, 65447, 65437, 65423, 65419, 65413,
+    65407, 65393, 65381, 65371, 65357, 65353, 65327, 65323, 65309, 65293,
+    65287, 65269, 65267, 65257, 65239, 65213, 65203, 65183, 65179, 65173,
+    65171, 65167, 65147, 65141, 65129, 65123, 65119, 65111, 65101, 65099,
+    65089, 65071, 65063, 65053, 65033, 65029, 65027, 65011, 65003, 64997,
+};
+
+const uint64_t mods_32[] = {
+    4294966661, 4294966657, 4294966651, 4294966639, 4294966619, 4294966591,
+    4294966583, 4294966553, 4294966477, 4294966447, 4294966441, 4294966427,
+    4294966373, 4294966367, 4294966337, 4294966297, 4294966243, 4294966237,
+    4294966231, 4294966217, 4294966187, 4294966177, 4294966163, 4294966153,
+    4294966129, 4294966121, 4294966099, 4294966087, 4294966073, 4294966043,
+};
+
+const uint64_t mods_64[] = {
+    9223372036854775783ULL, 9223372036854775643ULL, 9223372036854775549ULL,
+    9223372036854775507ULL, 9223372036854775433ULL, 9223372036854775421ULL,
+    9223372036854775417ULL, 9223372036854775399ULL, 9223372036854775351ULL,
+    9223372036854775337ULL, 9223372036854775291ULL, 9223372036854775279ULL,
+    9223372036854775259ULL, 9223372036854775181ULL, 9223372036854775159ULL,
+    9223372036854775139ULL, 9223372036854775097ULL, 9223372036854775073ULL,
+};
+
+void big_set(big_t *a, uint64_t v) {
+    memset(a, 0, sizeof(big_t));
+    while (v) {
+        a->limb[a->len++] = (uint32_t)v;
+        v >>= 32;
+    }
+}
+
+int big_bits(const big_t *a) {
+    if (a->len == 0) {
+        return 0;
+    }
+    return (a->len - 1) * 32 + (32 - __builtin_clz(a->limb[a->len - 1]));
+}
+
+uint64_t big_mod(const big_t *a, uint64_t m) {
+    unsigned __int128 r = 0;
+
+    for (int i = a->len - 1; i >= 0; i--) {
+        r = ((r << 32) | a->limb[i]) % m;
+    }
+    return (uint64_t)r;
+}
+
+// a = a * m + c
+void big_mul_add(big_t *a, uint64_t m, uint64_t c) {
+    unsigned __int128 carry = c;
+
+    for (int i = 0; i < a->len; i++) {
+        carry += (unsigned __int128)a->limb[i] * m;
+        a->limb[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    while (carry) {
+        a->limb[a->len++] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+// a = a + b * m
+void big_add_mul(big_t *a, const big_t *b, uint64_t m) {
+    unsigned __int128 carry = 0;
+    int len = a->len > b->len ? a->len : b->len;
+
+    for (int i = 0; i < len || carry; i++) {
+        carry += a->limb[i];
+        if (i < b->len) {
+            carry += (unsigned __int128)b->limb[i] * m;
+        }
+        a->limb[i] = (uint32_t)carry;
+        carry >>= 32;
+        if (i >= a->len) {
+            a->len = i + 1;
+        }
+    }
+}
+
+uint32_t big_div_small(big_t *a, uint32_t d) {
+    uint64_t r = 0;
+
+    for (int i = a->len - 1; i >= 0; i--) {
+        r = (r << 32) | a->limb[i];
+        a->limb[i] = (uint32_t)(r / d);
+        r %= d;
+    }
+    while (a->len && a->limb[a->len - 1] == 0) {
+        a->len--;
+    }
+    return (uint32_t)r;
+}
+
+void big_print(const big_t *a) {
+    uint32_t chunks[BIG_LIMBS * 32 / 29 + 1];
+    int chunks_cnt = 0;
+
+    big_t t = *a;
+    do {
+        chunks[chunks_cnt++] = big_div_small(&t, 1000000000);
+    } while (t.len);
+
+    printf("%u", chunks[--chunks_cnt]);
+    while (chunks_cnt) {
+        printf("%09u", chunks[--chunks_cnt]);
+    }
+}
+
+uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t m) {
+    return (uint64_t)((unsigned __int128)a * b % m);
+}
+
+uint64_t inv_mod(uint64_t a, uint64_t p) {
+    uint64_t r = 1, e = p - 2;
+
+    // p is prime, so a^(p - 2) is the inverse of a
+    for (a %= p; e; e >>= 1, a = mul_mod(a, a, p)) {
+        if (e & 1) {
+            r = mul_mod(r, a, p);
+        }
+    }
+    return r;
+}
+
+// The edge from the left and, for paths, whether the end is placed are the lowest bits of a
+// state, the vertical edges crossing the current row follow
+#define RELAX_FLAG (CYCLES ? 0 : 1)
+#define RELAX_LOW (2 << RELAX_FLAG)
+#define RELAX_STATES (1ULL << (N + 1 + RELAX_FLAG))
+
+// Whether the vertex at (row, col) may have the degree deg in the relaxation; a path places its
+// end with it if place is set
+int relax_allowed(int row, int col, int deg, int placed, int *place) {
+    *place = 0;
+    if (HAMILTONIAN) {
+        return deg == 2;
+    }
+    if (!CYCLES && row == 0 && col == 0) {
+        return deg == 1;
+    }
+    // A k x N or endpoint path ends on the last column or on the last row
+    if (!CYCLES && deg == 1 && !placed && (row == N - 1 || col == N - 1)) {
+        *place = 1;
+        return 1;
+    }
+    return deg == 0 || deg == 2;
+}
+
+typedef struct {
+    double *a;
+    double (*w)[2 * RELAX_LOW];
+    int col;
+    uint64_t begin, end;
+} relax_task_t;
+
+// Adds the cell to the states whose low bits and edge from above are groups begin to end - 1
+void *relax_cell(void *arg) {
+    const relax_task_t *task = arg;
+    double *a = task->a;
+    int col = task->col;
+    uint64_t up_bit = (uint64_t)RELAX_LOW << col, col_mask = (1ULL << col) - 1;
+
+    for (uint64_t g = task->begin; g < task->end; g++) {
+        double *lo = a + (((g >> col) << (col + 1)) | (g & col_mask)) * RELAX_LOW;
+        double *up = lo + up_bit;
+
+        double in[2 * RELAX_LOW], out[2 * RELAX_LOW];
+        for (int i = 0; i < RELAX_LOW; i++) {
+            in[i] = lo[i], in[RELAX_LOW + i] = up[i];
+        }
+        for (int j = 0; j < 2 * RELAX_LOW; j++) {
+            out[j] = 0;
+            for (int i = 0; i < 2 * RELAX_LOW; i++) {
+                out[j] += task->w[j][i] * in[i];
+            }
+        }
+        for (int i = 0; i < RELAX_LOW; i++) {
+            lo[i] = out[i], up[i] = out[RELAX_LOW + i];
+        }
+    }
+    return NULL;
+}
+
+// Counts the edge sets of the grid in which every vertex has a degree a solution can give it:
+// 2 for Hamiltonian cycles, 0 or 2 for cycles, and for paths 1 at the start and at one end on the
+// last row or column. Every solution is such a set, so is every k x N solution of the first k rows
+// and every endpoint path. Cells are added one at a time; a cell reads the edge from above and the
+// low bits of a state and replaces them with the edge below and the new low bits. Returns the
+// bits every count is below.
+int count_bound_bits(int threads_cnt) {
+    // The table is freed before the counters are used, but it has to fit next to them and the
+    // lookup tables; otherwise the general bound is used
+    double *a = RELAX_STATES * sizeof(double) <= available_memory() / 2 ?
+                calloc(RELAX_STATES, sizeof(double)) : NULL;
+    if (a == NULL) {
+        return COUNT_BOUND_BITS;
+    }
+
+    uint64_t groups_cnt = RELAX_STATES / (2 * RELAX_LOW);
+    threads_cnt = (uint64_t)threads_cnt < groups_cnt ? threads_cnt : 1;
+    pthread_t threads[threads_cnt];
+    int started[threads_cnt];
+    relax_task_t tasks[threads_cnt];
+
+    a[0] = 1;
+    double bound = 0;
+    for (int row = 0; row < N; row++) {
+        for (int col = 0; col < N; col++) {
+            // Transitions of the cell, from the edge from above (bit RELAX_LOW) and the low bits
+            double w[2 * RELAX_LOW][2 * RELAX_LOW] = {{0}};
+            for (int i = 0; i < 2 * RELAX_LOW; i++) {
+                int left = i & 1, placed = RELAX_FLAG && i & 2, up = i / RELAX_LOW;
+                for (int down = 0; down <= (row < N - 1); down++) {
+                    for (int right = 0; right <= (col < N - 1); right++) {
+                        int place;
+                        if (relax_allowed(row, col, up + left + down + right, placed, &place)) {
+                            w[down * RELAX_LOW + (placed | place) * 2 + right][i] = 1;
+                        }
+                    }
+                }
+            }
+
+            for (int t = 0; t < threads_cnt; t++) {
+                tasks[t] = (relax_task_t){a, w, col, groups_cnt * t / threads_cnt,
+                                          groups_cnt * (t + 1) / threads_cnt};
+                started[t] = t > 0 && pthread_create(&threads[t], NULL, relax_cell, &tasks[t]) == 0;
+            }
+            for (int t = 0; t < threads_cnt; t++) {
+                if (!started[t]) {
+                    relax_cell(&tasks[t]);
+                }
+            }
+            for (int t = 1; t < threads_cnt; t++) {
+                if (started[t]) {
+                    pthread_join(threads[t], NULL);
+                }
+            }
+        }
+
+        // Without edges below the row, its first row + 1 rows are complete; paths need their end
+        double rows = a[CYCLES ? 0 : 2];
+        bound = rows > bound ? rows : bound;
+    }
+    free(a);
+
+    // Every addition rounds by at most 2^-53, far below the margin
+    int bits = 0;
+    for (bound *= 1 + 1e-9; bound >= 1; bound /= 2) {
+        bits++;
+    }
+    return bits < COUNT_BOUND_BITS ? bits : COUNT_BOUND_BITS;
+}
+
+int select_mods(uint64_t *mods, int bits, int bound_bits) {
+    const uint64_t *table;
+    int table_cnt;
+
+    switch (bits) {
+    case 8:
+        table = mods_8, table_cnt = MODS_CNT(mods_8);
+        break;
+    case 1 ... 7:
+        // Sliced counters take the 8-bit primes below 2^bits
+        table = mods_8, table_cnt = MODS_CNT(mods_8);
+        while (table_cnt > 0 && *table >= (1ULL << bits)) {
+            table++, table_cnt--;
+        }
+        break;
+    case 16:
+        table = mods_16, table_cnt = MODS_CNT(mods_16);
+        break;
+    case 32:
+        table = mods_32, table_cnt = MODS_CNT(mods_32);
+        break;
+    default:
+        table = mods_64, table_cnt = MODS_CNT(mods_64);
+    }
+
+    // Counts are below 2^bound_bits, so the moduli product must reach it
+    big_t product;
+    big_set(&product, 1);
+
+    for (int i = 0; i < table_cnt; i++) {
+        mods[i] = table[i];
+        big_mul_add(&product, table[i], 0);
+
+        if (big_bits(&product) > bound_bits) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+void crt_init(crt_t *crt) {
+    big_set(&crt->value, 0);
+    big_set(&crt->product, 1);
+}
+
+void crt_add(crt_t *crt, uint64_t residue, uint64_t mod) {
+    // value += product * ((residue - value) / product mod p)
+    uint64_t value_mod = big_mod(&crt->value, mod);
+    uint64_t diff = (residue % mod + mod - value_mod) % mod;
+    uint64_t t = mul_mod(diff, inv_mod(big_mod(&crt->product, mod), mod), mod);
+
+    big_add_mul(&crt->value, &crt->product, t);
+    big_mul_add(&crt->product, mod, 0);
+}
@@ -0,0 +1,33 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include "defs.h"
+
+// Every vertex that has both a right and a down edge chooses between at most two ways of
+// continuing the partial solution, all other vertices are forced. There are (N - 1)^2 such
+// vertices, so every count (and every k x N or endpoint count) is below 2^((N - 1)^2).
+// count_bound_bits() computes a closer bound for the mode.
+#define COUNT_BOUND_BITS ((N - 1) * (N - 1))
+
+// Enough limbs for the product of the moduli covering COUNT_BOUND_BITS at N = 30
+#define BIG_LIMBS 32
+
+typedef struct {
+    uint32_t limb[BIG_LIMBS];
+    int len;
+} big_t;
+
+typedef struct {
+    big_t value, product;
+} crt_t;
+
+int count_bound_bits(int);
+int select_mods(uint64_t *, int, int);
+
+void crt_init(crt_t *);
+void crt_add(crt_t *, uint64_t, uint64_t);
+
+void big_print(const big_t *);
@@ -14,6 +14,10 @@
 #define HAMILTONIAN 0
 #endif
 
+#ifndef VERIFY
+#define VERIFY 0
+#endif
+
 // Grid
 #define N_LO (((uint64_t)N) / 2)
 #define N_HI ((((uint64_t)N) + 1) / 2)
@@ -47,16 +51,51 @@
 // Cell states
 enum { BLANK, LEFT, RIGHT, BLOCK };
 
-// Counter type
+#ifndef SLICE_BITS
+#define SLICE_BITS 0
+#endif
+
+// Counter type. With SLICE_BITS (BITS below 8) the residues are stored as bit planes, see
+// slice.h, and counters are addressed by their index instead of a pointer.
 typedef TYPE counter_t;
+#define NARROW_MOD_MAX ((counter_t)~(counter_t)0 >> 1)
+
+#if SLICE_BITS
+typedef uint64_t counter_ptr_t;
+#define COUNTER_BITS SLICE_BITS
+#else
+typedef counter_t *counter_ptr_t;
+#define COUNTER_BITS ((int)sizeof(counter_t) * 8)
+#endif
+
+// Sliced counters of a hi state start at a plane word of their own, so threads working on
+// different groups never write the same word
+#define COUNTERS_ALIGN(cnt) (SLICE_BITS ? ((cnt) + 63) / 64 * 64 : (cnt))
+#define COUNTERS_SIZE(cnt) \
+    (SLICE_BITS ? ((cnt) + 63) / 64 * SLICE_BITS * 8 : (cnt) * sizeof(counter_t))
 
 // Grid context
 typedef struct {
     // Counters and lookup tables
-    counter_t *main, *blocked;
+    counter_ptr_t main, blocked;
+    uint64_t counters_cnt, blocked_cnt;
+
+    // Obstacles: cut positions that have to be blank when a row starts, missing vertices and
+    // missing horizontal edges
+    int obstacles;
+    uint64_t obstacle_cut[N];
+    uint64_t obstacle_vertices[N];
+    uint32_t obstacle_edges[N];
+
+    // Columns a cut can be in, the states of the missing columns after them are left out
+    int cols;
     uint64_t *lookup[2];
 
+    // Size of the tables file the lookups below are mapped from, 0 when they are private
+    uint64_t tables_size;
+
     // Hi and lo states
+    uint32_t states_hi_cnt;
     uint32_t *states_hi;
     uint32_t *states_lo[STATES_LO_BUCKET_CNT];
     uint32_t states_lo_cnt[STATES_LO_BUCKET_CNT];
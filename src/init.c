@@ -4,17 +4,46 @@
   This file is part of the FastGridPathCounter repository.
 */
 
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "init.h"
 #include "inline.h"
 
 #define CUTS_LIMIT_LO (1ULL << (2 * N_LO))
 #define CUTS_LIMIT_HI (1ULL << (2 * N_HI))
 
+// Shared tables file: a header, an image of the context and every table at an aligned offset
+#define TABLES_MAGIC 0x53454c4241544350ULL
+#define TABLES_VERSION 2
+#define TABLES_ALIGN 64
+#define TABLES_MAX (8 + STATES_LO_BUCKET_CNT * (2 * N_LO + 1))
+
+#define ALIGN_UP(size) (((size) + TABLES_ALIGN - 1) & ~(uint64_t)(TABLES_ALIGN - 1))
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version, n, cycles, hamiltonian, slice_bits, cols;
+    uint64_t context_size, size;
+} tables_header_t;
+
+typedef struct {
+    void **ptr;
+    uint64_t size;
+} table_t;
+
 uint64_t g_memory_allocated = 0;
 
+// Bit planes of all sliced counters, main ones first, see slice.h
+uint64_t *g_slices = NULL;
+uint64_t g_slices_cnt = 0;
+
 void *alloc(size_t size, int tmp) {
     void *ptr = malloc(size);
 
@@ -81,23 +110,27 @@ uint32_t group_id(uint32_t r) {
     return id;
 }
 
+// States with a cut in a missing column after the first cols are left out. Only such a suffix
+// can be dropped: the blocked states are shifted, so they stay in the same set.
 void init_balanced_states(uint32_t *balanced_lo, uint32_t *balanced_hi, uint32_t *balanced_lo_cnt,
-                          uint32_t *balanced_hi_cnt) {
+                          uint32_t *balanced_hi_cnt, int cols) {
+    uint64_t dead = ~((1ULL << (cols << I_SHIFT)) - 1);
     *balanced_lo_cnt = *balanced_hi_cnt = 0;
 
     for (uint32_t i = 0; i < CUTS_LIMIT_LO; i++) {
-        if (is_balanced_lo(i)) {
+        if (is_balanced_lo(i) && !(i & dead)) {
             balanced_lo[(*balanced_lo_cnt)++] = i;
         }
     }
     for (uint32_t i = 0; i < CUTS_LIMIT_HI; i++) {
-        if (is_balanced_hi(i)) {
+        if (is_balanced_hi(i) && !(((uint64_t)i << SHIFT_N_LO) & dead)) {
             balanced_hi[(*balanced_hi_cnt)++] = i;
         }
     }
 }
 
 void init_hi_cnt_lookup(grid_context_t *context, const uint32_t *balanced_hi, uint32_t balanced_hi_cnt) {
+    context->states_hi_cnt = balanced_hi_cnt;
     context->states_hi = (uint32_t *)alloc(balanced_hi_cnt * sizeof(uint32_t), 0);
     context->hi_cnt_lookup = (uint8_t *)alloc(balanced_hi_cnt, 0);
 
@@ -155,7 +188,7 @@ void init_lookups_and_counts(grid_context_t *context, const uint32_t *balanced_h
         uint32_t c = context->hi_cnt_lookup[i];
 
         context->lookup[1][state_hi] = hi_cnt;
-        hi_cnt += cl_cnt[c];
+        hi_cnt += COUNTERS_ALIGN(cl_cnt[c]);
 
         if (state_hi < CUTS_LIMIT_HI / 4) {
             *blocked_cnt = hi_cnt;
@@ -189,8 +222,9 @@ void init_buckets(grid_context_t *context) {
             context->state_lo_buckets_size[i][b] =
                 (uint32_t *)alloc(context->states_lo_cnt[b] * sizeof(uint32_t), 0);
 
+            // An empty list has no buckets, its first state would be read past the table
             uint32_t j_start = 0, l_cnt = 0;
-            for (uint32_t j = 0; j <= context->states_lo_cnt[b]; j++) {
+            for (uint32_t j = 1; j <= context->states_lo_cnt[b]; j++) {
                 if (j == context->states_lo_cnt[b] ||
                     (context->states_lo[b][j_start] >> i_shifted) !=
                         (context->states_lo[b][j] >> i_shifted)) {
@@ -205,14 +239,26 @@ void init_buckets(grid_context_t *context) {
     }
 }
 
-void allocate_counters(grid_context_t *context, uint64_t counters_cnt, uint64_t blocked_cnt) {
+void allocate_counters(grid_context_t *context) {
     uint64_t counters_size, blocked_size;
 
-    counters_size = counters_cnt * sizeof(counter_t);
+#if SLICE_BITS
+    // Blocked counters follow the main ones in the same planes, one more block of padding lets
+    // a range be read across the end of the last one
+    counters_size = COUNTERS_SIZE(context->counters_cnt);
+    blocked_size = COUNTERS_SIZE(context->blocked_cnt) + SLICE_BITS * sizeof(uint64_t);
+
+    g_slices_cnt = (counters_size + blocked_size) / sizeof(uint64_t);
+    g_slices = (uint64_t *)alloc(counters_size + blocked_size, 0);
+    context->main = 0;
+    context->blocked = context->counters_cnt;
+#else
+    counters_size = context->counters_cnt * sizeof(counter_t);
     context->main = (counter_t *)alloc(counters_size, 0);
 
-    blocked_size = blocked_cnt * sizeof(counter_t);
+    blocked_size = context->blocked_cnt * sizeof(counter_t);
     context->blocked = (counter_t *)alloc(blocked_size, 0);
+#endif
 }
 
 int replace_left_value(uint32_t state) {
@@ -247,16 +293,322 @@ void init_replace_lookups(grid_context_t *context) {
     }
 }
 
-grid_context_t *init() {
-    grid_context_t *context = alloc(sizeof(grid_context_t), 1);
+void reset_counters(const grid_context_t *context) {
+#if SLICE_BITS
+    memset(g_slices, 0, g_slices_cnt * sizeof(uint64_t));
+#else
+    memset(context->main, 0, context->counters_cnt * sizeof(counter_t));
+    memset(context->blocked, 0, context->blocked_cnt * sizeof(counter_t));
+#endif
+}
+
+int is_missing(const mask_t *mask, int row, int col) {
+    return row < 0 || row >= N || col < 0 || col >= N || ((mask->vertices[row] >> col) & 1);
+}
+
+// An edge is missing with either of its vertices
+int is_edge_missing(const mask_t *mask, int row, int col, int down) {
+    int row2 = row + down, col2 = col + !down;
+    const uint32_t *edges = down ? mask->down : mask->right;
+    return is_missing(mask, row, col) || is_missing(mask, row2, col2) || ((edges[row] >> col) & 1);
+}
+
+// A column no edge reaches never holds a cut
+int is_column_dead(const mask_t *mask, int col) {
+    for (int row = 0; row < N; row++) {
+        if (!is_edge_missing(mask, row, col, 0) || !is_edge_missing(mask, row, col - 1, 0) ||
+            !is_edge_missing(mask, row, col, 1) || !is_edge_missing(mask, row - 1, col, 1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Columns before the dead ones at the end, the states need at least two for the first cell
+int mask_columns(const mask_t *mask) {
+    int cols = N;
+    while (cols > 2 && is_column_dead(mask, cols - 1)) {
+        cols--;
+    }
+    return cols;
+}
+
+// Symmetry bits: transpose, then flip the rows, then flip the columns
+void transform_vertex(int symmetry, int *row, int *col) {
+    if (symmetry & 1) {
+        int t = *row;
+        *row = *col;
+        *col = t;
+    }
+    if (symmetry & 2) {
+        *row = N - 1 - *row;
+    }
+    if (symmetry & 4) {
+        *col = N - 1 - *col;
+    }
+}
+
+void transform_edge(const mask_t *src, mask_t *dest, int symmetry, int row, int col, int down) {
+    const uint32_t *edges = down ? src->down : src->right;
+    if (!((edges[row] >> col) & 1)) {
+        return;
+    }
+
+    int row2 = row + down, col2 = col + !down;
+    transform_vertex(symmetry, &row, &col);
+    transform_vertex(symmetry, &row2, &col2);
+
+    if (row == row2) {
+        dest->right[row] |= 1U << (col < col2 ? col : col2);
+    } else {
+        dest->down[row < row2 ? row : row2] |= 1U << col;
+    }
+}
+
+void transform_mask(const mask_t *src, mask_t *dest, int symmetry) {
+    memset(dest, 0, sizeof(mask_t));
+
+    for (int row = 0; row < N; row++) {
+        for (int col = 0; col < N; col++) {
+            if ((src->vertices[row] >> col) & 1) {
+                int r = row, c = col;
+                transform_vertex(symmetry, &r, &c);
+                dest->vertices[r] |= 1U << c;
+            }
+            transform_edge(src, dest, symmetry, row, col, 0);
+            transform_edge(src, dest, symmetry, row, col, 1);
+        }
+    }
+}
+
+// Cycles are counted the same in every orientation of the grid, the one with the most dead
+// columns at its end needs the fewest states. Returns the symmetry used.
+int orient_mask(mask_t *mask) {
+    mask_t best = *mask, oriented;
+    int best_symmetry = 0;
+
+    for (int symmetry = 1; symmetry < 8; symmetry++) {
+        transform_mask(mask, &oriented, symmetry);
+        if (mask_columns(&oriented) < mask_columns(&best)) {
+            best = oriented;
+            best_symmetry = symmetry;
+        }
+    }
+    *mask = best;
+    return best_symmetry;
+}
+
+void set_obstacles(grid_context_t *context, const mask_t *mask) {
+    context->obstacles = 0;
+
+    for (int row = 0; row < N; row++) {
+        context->obstacle_cut[row] = 0;
+        context->obstacle_vertices[row] = 0;
+        context->obstacle_edges[row] = 0;
+
+        for (int col = 0; col < N; col++) {
+            uint64_t position = VALUE_MASK << (col << I_SHIFT);
+
+            // A cut into the row needs the edge from the vertex above
+            if (is_missing(mask, row, col) || (row > 0 && is_edge_missing(mask, row - 1, col, 1))) {
+                context->obstacle_cut[row] |= position;
+            }
+            if (is_missing(mask, row, col)) {
+                context->obstacle_vertices[row] |= position;
+            }
+            if (col < N - 1 && is_edge_missing(mask, row, col, 0)) {
+                context->obstacle_edges[row] |= 1U << col;
+            }
+        }
+        context->obstacles |= mask->vertices[row] != 0 || mask->right[row] != 0 ||
+                              mask->down[row] != 0;
+    }
+}
+
+void init_sizes(grid_sizes_t *sizes) {
+    uint64_t states_lo_cnt[STATES_LO_BUCKET_CNT] = {0};
+    memset(sizes, 0, sizeof(grid_sizes_t));
+
+    // Same enumeration as init(), counting instead of storing
+    for (uint32_t i = 0; i < CUTS_LIMIT_LO; i++) {
+        if (is_balanced_lo(i)) {
+            states_lo_cnt[(uint8_t)(-get_right_cnt(i) + (CYCLES ? 0 : 1))]++;
+            sizes->balanced_lo_cnt++;
+        }
+    }
+    for (uint32_t i = 0; i < CUTS_LIMIT_HI; i++) {
+        if (is_balanced_hi(i)) {
+            sizes->counters_cnt += COUNTERS_ALIGN(states_lo_cnt[(uint8_t)get_right_cnt(i)]);
+            if (i < CUTS_LIMIT_HI / 4) {
+                sizes->blocked_cnt = sizes->counters_cnt;
+            }
+            sizes->balanced_hi_cnt++;
+        }
+    }
+
+    // Everything allocated by init() except the counters
+    sizes->tables_size = sizes->balanced_hi_cnt * (sizeof(uint32_t) + sizeof(uint8_t)) +
+                         sizes->balanced_lo_cnt * sizeof(uint32_t) +
+                         (CUTS_LIMIT_LO + CUTS_LIMIT_HI) * sizeof(uint64_t) +
+                         GROUP_CNT_2 * GROUP_BUCKET_CNT * sizeof(uint32_t) +
+                         N_LO * 2 * sizes->balanced_lo_cnt * sizeof(uint32_t) +
+                         2 * REPLACE_LOOKUP_SIZE;
+
+    // Temporary lookups, freed before the counters are allocated
+    sizes->tmp_size = (CUTS_LIMIT_LO + CUTS_LIMIT_HI) * sizeof(uint32_t) + sizes->balanced_lo_cnt;
+}
+
+// Every read-only table with its size, in the order they are laid out in a tables file
+int list_tables(grid_context_t *context, table_t *tables) {
+    int cnt = 0;
+
+    tables[cnt++] = (table_t){(void **)&context->lookup[0], CUTS_LIMIT_LO * sizeof(uint64_t)};
+    tables[cnt++] = (table_t){(void **)&context->lookup[1], CUTS_LIMIT_HI * sizeof(uint64_t)};
+    tables[cnt++] =
+        (table_t){(void **)&context->states_hi, context->states_hi_cnt * sizeof(uint32_t)};
+    tables[cnt++] = (table_t){(void **)&context->hi_cnt_lookup, context->states_hi_cnt};
+    tables[cnt++] = (table_t){(void **)&context->groups,
+                              GROUP_CNT_2 * GROUP_BUCKET_CNT * sizeof(uint32_t)};
+
+    for (uint32_t b = 0; b < STATES_LO_BUCKET_CNT; b++) {
+        uint64_t size = context->states_lo_cnt[b] * sizeof(uint32_t);
+
+        tables[cnt++] = (table_t){(void **)&context->states_lo[b], size};
+        for (uint32_t i = 0; i < N_LO; i++) {
+            tables[cnt++] = (table_t){(void **)&context->state_lo_buckets[i][b], size};
+            tables[cnt++] = (table_t){(void **)&context->state_lo_buckets_size[i][b], size};
+        }
+    }
+
+    tables[cnt++] = (table_t){(void **)&context->replace_left_lookup, REPLACE_LOOKUP_SIZE};
+    tables[cnt++] = (table_t){(void **)&context->replace_right_lookup, REPLACE_LOOKUP_SIZE};
+    return cnt;
+}
+
+void init_tables_header(tables_header_t *header, uint64_t size, int cols) {
+    memset(header, 0, sizeof(tables_header_t));
+    header->magic = TABLES_MAGIC;
+    header->version = TABLES_VERSION;
+    header->n = N;
+    header->cycles = CYCLES;
+    header->hamiltonian = HAMILTONIAN;
+    header->slice_bits = SLICE_BITS;
+    header->cols = cols;
+    header->context_size = sizeof(grid_context_t);
+    header->size = size;
+}
+
+// Written to a temporary file and renamed, so concurrent processes never map a partial file
+int save_tables(grid_context_t *context, const char *path) {
+    static const uint8_t padding[TABLES_ALIGN] = {0};
+
+    table_t tables[TABLES_MAX];
+    int tables_cnt = list_tables(context, tables);
+
+    uint64_t size = ALIGN_UP(sizeof(tables_header_t) + sizeof(grid_context_t));
+    for (int t = 0; t < tables_cnt; t++) {
+        size += ALIGN_UP(tables[t].size);
+    }
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        return 0;
+    }
+
+    tables_header_t header;
+    init_tables_header(&header, size, context->cols);
+
+    uint64_t offset = sizeof(tables_header_t) + sizeof(grid_context_t);
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(context, sizeof(grid_context_t), 1, f) == 1 &&
+             fwrite(padding, 1, ALIGN_UP(offset) - offset, f) == ALIGN_UP(offset) - offset;
+    for (int t = 0; t < tables_cnt && ok; t++) {
+        uint64_t pad = ALIGN_UP(tables[t].size) - tables[t].size;
+        ok = fwrite(*tables[t].ptr, 1, tables[t].size, f) == tables[t].size &&
+             fwrite(padding, 1, pad, f) == pad;
+    }
+
+    if (fclose(f) != 0 || !ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Points the context at the tables of a file built by the same N, mode and columns. The mapping is
+// read-only and shared, so every process on the host uses the same physical pages.
+int map_tables(grid_context_t *context, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    tables_header_t header, expected;
+    struct stat st;
+    int ok = read(fd, &header, sizeof(header)) == sizeof(header) && fstat(fd, &st) == 0;
+
+    uint64_t offset = ALIGN_UP(sizeof(tables_header_t) + sizeof(grid_context_t));
+    init_tables_header(&expected, header.size, context->cols);
+    if (!ok || memcmp(&header, &expected, sizeof(header)) != 0 ||
+        (uint64_t)st.st_size != header.size || header.size < offset) {
+        close(fd);
+        return 0;
+    }
+
+    uint8_t *base = mmap(NULL, header.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return 0;
+    }
 
+    int cols = context->cols;
+    memcpy(context, base + sizeof(tables_header_t), sizeof(grid_context_t));
+
+    // The sizes come from the context image, a truncated or stale file must not place a table
+    // past the end of the mapping
+    table_t tables[TABLES_MAX];
+    int tables_cnt = list_tables(context, tables);
+
+    uint64_t size = offset;
+    for (int t = 0; t < tables_cnt; t++) {
+        size += ALIGN_UP(tables[t].size);
+    }
+    if (size != header.size) {
+        munmap(base, header.size);
+        memset(context, 0, sizeof(grid_context_t));
+        context->cols = cols;
+        return 0;
+    }
+
+    for (int t = 0; t < tables_cnt; t++) {
+        *tables[t].ptr = base + offset;
+        offset += ALIGN_UP(tables[t].size);
+    }
+    context->tables_size = header.size;
+    return 1;
+}
+
+void free_tables(grid_context_t *context) {
+    table_t tables[TABLES_MAX];
+    int tables_cnt = list_tables(context, tables);
+
+    for (int t = 0; t < tables_cnt; t++) {
+        free(*tables[t].ptr);
+        g_memory_allocated -= tables[t].size;
+    }
+}
+
+void build_tables(grid_context_t *context) {
     // Allocate temporary lookups
     uint32_t *balanced_lo = (uint32_t *)alloc(CUTS_LIMIT_LO * sizeof(uint32_t), 1);
     uint32_t *balanced_hi = (uint32_t *)alloc(CUTS_LIMIT_HI * sizeof(uint32_t), 1);
 
     // Initialize balanced states
     uint32_t balanced_lo_cnt, balanced_hi_cnt;
-    init_balanced_states(balanced_lo, balanced_hi, &balanced_lo_cnt, &balanced_hi_cnt);
+    init_balanced_states(balanced_lo, balanced_hi, &balanced_lo_cnt, &balanced_hi_cnt,
+                         context->cols);
 
     // Initialize hi_cnt_lookup
     init_hi_cnt_lookup(context, balanced_hi, balanced_hi_cnt);
@@ -266,9 +618,8 @@ grid_context_t *init() {
     init_states_lo(context, balanced_lo, balanced_lo_cnt, cl_cnt);
 
     // Initialize lookups and get the size of counters and blocked states
-    uint64_t counters_cnt, blocked_cnt;
-    init_lookups_and_counts(context, balanced_hi, balanced_hi_cnt, cl_cnt, &counters_cnt,
-                            &blocked_cnt);
+    init_lookups_and_counts(context, balanced_hi, balanced_hi_cnt, cl_cnt, &context->counters_cnt,
+                            &context->blocked_cnt);
 
     // Initialize groups
     init_groups(context, balanced_hi, balanced_hi_cnt);
@@ -283,11 +634,38 @@ grid_context_t *init() {
     free(balanced_lo);
     free(balanced_hi);
     free(cl_cnt);
+}
+
+grid_context_t *init(const char *tables_path, const mask_t *mask) {
+    grid_context_t *context = alloc(sizeof(grid_context_t), 1);
+    context->cols = mask_columns(mask);
+
+    // Tables saved by an earlier process are mapped instead of built; a new file is mapped right
+    // after it is written, so its builder shares it as well
+    int shared = tables_path != NULL && map_tables(context, tables_path);
+    if (!shared) {
+        build_tables(context);
+
+        if (tables_path != NULL) {
+            if (save_tables(context, tables_path)) {
+                free_tables(context);
+                shared = map_tables(context, tables_path);
+            }
+            if (!shared) {
+                perror(tables_path);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
 
     // Allocate counters
-    allocate_counters(context, counters_cnt, blocked_cnt);
+    allocate_counters(context);
 
-    printf("memory   = %lluMB\n\n", g_memory_allocated / (1 << 20));
+    if (shared) {
+        printf("tables   = %s (%" PRIu64 "MB shared)\n", tables_path,
+               context->tables_size / (1 << 20));
+    }
+    printf("memory   = %" PRIu64 "MB\n", g_memory_allocated / (1 << 20));
 
     return context;
 }
@@ -6,4 +6,21 @@
 
 #include "defs.h"
 
-grid_context_t *init();
+typedef struct {
+    uint64_t balanced_lo_cnt, balanced_hi_cnt;
+    uint64_t counters_cnt, blocked_cnt;
+    uint64_t tables_size, tmp_size;
+} grid_sizes_t;
+
+// Missing vertices and edges, bit col of each row; right is the edge to col + 1, down the one to
+// row + 1
+typedef struct {
+    uint32_t vertices[N], right[N], down[N];
+} mask_t;
+
+grid_context_t *init(const char *, const mask_t *);
+void init_sizes(grid_sizes_t *);
+void reset_counters(const grid_context_t *);
+int mask_columns(const mask_t *);
+int orient_mask(mask_t *);
+void set_obstacles(grid_context_t *, const mask_t *);
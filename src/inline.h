@@ -6,6 +6,12 @@
 
 #include "defs.h"
 
+// Sum of the changes this thread made to the counters, see verify.c
+extern __thread uint64_t t_checksum_delta;
+
+// Non-zero states this thread has processed in its current group, see stats.c
+extern __thread uint64_t t_states_done;
+
 inline uint64_t state_value(uint64_t state, int i) {
     return (state >> (i << I_SHIFT)) & VALUE_MASK;
 }
@@ -40,11 +46,11 @@ inline uint64_t counters_lookup_pos(const grid_context_t *context, uint64_t stat
     return context->lookup[0][state & CUTS_MASK_LO] + context->lookup[1][state >> SHIFT_N_LO];
 }
 
-inline counter_t *counters_main_ptr(const grid_context_t *context, uint64_t state) {
+inline counter_ptr_t counters_main_ptr(const grid_context_t *context, uint64_t state) {
     return context->main + counters_lookup_pos(context, state);
 }
 
-inline counter_t *counters_blocked_ptr(const grid_context_t *context, uint64_t state) {
+inline counter_ptr_t counters_blocked_ptr(const grid_context_t *context, uint64_t state) {
     return context->blocked + counters_lookup_pos(context, state);
 }
 
@@ -57,53 +63,146 @@ inline uint32_t group_cnt(const grid_context_t *context, int col, uint32_t group
     return context->group_cnt[GROUP_BUCKET(col)][group];
 }
 
-inline void _add_mod(counter_t *dest, const counter_t *src, counter_t mod) {
-    uint64_t v = (uint64_t)(*dest) + (uint64_t)(*src);
-    if (v > mod) {
-        v -= mod;
+inline int has_edge(const grid_context_t *context, int row, int col) {
+    return !((context->obstacle_edges[row] >> col) & 1);
+}
+
+inline void track(uint64_t delta) {
+    if (VERIFY) {
+        t_checksum_delta += delta;
     }
-    *dest = v;
 }
 
-inline void _add_mod_reset(counter_t *dest, counter_t *src, counter_t mod) {
+#if SLICE_BITS
+#include "slice.h"
+#else
+
+inline counter_t get_counter(counter_ptr_t p) {
+    return *p;
+}
+
+inline void set_counter(counter_ptr_t p, counter_t v) {
+    *p = v;
+}
+
+inline int is_zero(const counter_t *counters, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        if (counters[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The _delta variants return the change of the counter sum, which is dead code unless VERIFY is
+// set; the loops below collect it in a register and publish it once
+
+inline uint64_t _add_mod_delta(counter_t *dest, const counter_t *src, counter_t mod) {
+    counter_t c = *dest;
+
+    // Moduli in the lower half of the counter range can't overflow, so the sum stays in counter
+    // width and the loops vectorize over full-width lanes; the check is hoisted out of them
+    if (mod <= NARROW_MOD_MAX) {
+        counter_t v = *dest + *src;
+        if (v > mod) {
+            v -= mod;
+        }
+        *dest = v;
+    } else {
+        uint64_t v = (uint64_t)(*dest) + (uint64_t)(*src);
+        if (v > mod) {
+            v -= mod;
+        }
+        *dest = v;
+    }
+    return (uint64_t)*dest - c;
+}
+
+inline uint64_t _add_mod_reset_delta(counter_t *dest, counter_t *src, counter_t mod) {
+    uint64_t delta;
     if (HAMILTONIAN) {
+        delta = (uint64_t)*src - *dest;
         *dest = *src;
     } else {
-        _add_mod(dest, src, mod);
+        delta = _add_mod_delta(dest, src, mod);
     }
+    delta -= *src;
     *src = 0;
+    return delta;
 }
 
-inline void _add_mod_twice(counter_t *dest, counter_t *dest_new, counter_t *src, counter_t mod) {
-    _add_mod(dest_new, dest, mod);
-    _add_mod_reset(dest, src, mod);
+inline uint64_t _add_mod_twice_delta(counter_t *dest, counter_t *dest_new, counter_t *src,
+                                     counter_t mod) {
+    uint64_t delta = _add_mod_delta(dest_new, dest, mod);
+    return delta + _add_mod_reset_delta(dest, src, mod);
 }
 
-inline void _add_mod_set_src(counter_t *dest, counter_t *src, counter_t mod) {
+inline uint64_t _add_mod_set_src_delta(counter_t *dest, counter_t *src, counter_t mod) {
     counter_t c = *dest;
+    uint64_t delta;
     if (HAMILTONIAN) {
+        delta = (uint64_t)*src - c;
         *dest = *src;
     } else {
-        _add_mod(dest, src, mod);
+        delta = _add_mod_delta(dest, src, mod);
     }
+    delta += (uint64_t)c - *src;
     *src = c;
+    return delta;
+}
+
+inline void _add_mod(counter_t *dest, const counter_t *src, counter_t mod) {
+    track(_add_mod_delta(dest, src, mod));
+}
+
+inline void _add_mod_reset(counter_t *dest, counter_t *src, counter_t mod) {
+    track(_add_mod_reset_delta(dest, src, mod));
+}
+
+inline void _add_mod_twice(counter_t *dest, counter_t *dest_new, counter_t *src, counter_t mod) {
+    track(_add_mod_twice_delta(dest, dest_new, src, mod));
+}
+
+inline void _add_mod_set_src(counter_t *dest, counter_t *src, counter_t mod) {
+    track(_add_mod_set_src_delta(dest, src, mod));
 }
 
 inline void add_mod_twice(uint32_t len, counter_t *dest, counter_t *dest_new, counter_t *src,
                           counter_t mod) {
+    uint64_t delta = 0;
     for (uint32_t i = 0; i < len; i++, dest++, dest_new++, src++) {
-        _add_mod_twice(dest, dest_new, src, mod);
+        delta += _add_mod_twice_delta(dest, dest_new, src, mod);
     }
+    track(delta);
 }
 
 inline void add_mod_set_src(uint32_t len, counter_t *dest, counter_t *src, counter_t mod) {
+    uint64_t delta = 0;
+    for (uint32_t i = 0; i < len; i++, dest++, src++) {
+        delta += _add_mod_set_src_delta(dest, src, mod);
+    }
+    track(delta);
+}
+
+inline void add_mod_reset(uint32_t len, counter_t *dest, counter_t *src, counter_t mod) {
+    uint64_t delta = 0;
     for (uint32_t i = 0; i < len; i++, dest++, src++) {
-        _add_mod_set_src(dest, src, mod);
+        delta += _add_mod_reset_delta(dest, src, mod);
     }
+    track(delta);
 }
 
 inline void add_mod(uint32_t len, counter_t *dest, counter_t *src, counter_t mod) {
+    uint64_t delta = 0;
     for (uint32_t i = 0; i < len; i++, dest++, src++) {
-        _add_mod(dest, src, mod);
+        delta += _add_mod_delta(dest, src, mod);
     }
+    track(delta);
+}
+
+#endif
+
+inline void clear_counter(counter_ptr_t p) {
+    track(0 - (uint64_t)get_counter(p));
+    set_counter(p, 0);
 }
@@ -4,21 +4,67 @@
   This file is part of the FastGridPathCounter repository.
 */
 
+#include <getopt.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "count.h"
+#include "crt.h"
 #include "init.h"
 #include "inline.h"
+#include "plan.h"
+#include "report.h"
+#include "stats.h"
+#include "tune.h"
+#include "verify.h"
 
 typedef struct {
+    counter_t mod;
+    int rows;
+    int endpoints;
+    int server;
+    int crt;
+    int jobs;
+    tuning_t tuning;
+    int profile;
+    int tune;
+    int plan;
+    uint64_t memory;
+    const char *tables;
+    const char *mask;
+    mask_t missing;
+    int missing_cnt, missing_edges_cnt, symmetry;
+    const char *stats_path;
+    stats_t *stats;
+    const char *snapshot_path;
+    int snapshot_rows;
+    snapshot_t *snapshot;
+    int progress;
+} options_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t row_count[N];
+    uint64_t endpoint_count[N];
+} result_t;
+
+typedef struct {
+    group_task_t task;
     const grid_context_t *context;
     counter_t mod;
-    int col;
+    int row, col;
     uint32_t *groups;
     uint32_t groups_cnt;
     int next_task_index;
+    int next_thread_index;
+    stats_t *stats;
+    uint64_t checksum_delta;
     pthread_mutex_t task_mutex;
 } thread_pool_data_t;
 
@@ -31,6 +77,12 @@ void pthread_assert(int ret) {
 
 void *process_group_tasks(void *arg) {
     thread_pool_data_t *data = (thread_pool_data_t *)arg;
+    t_checksum_delta = 0;
+    t_states_done = 0;
+
+    pthread_assert(pthread_mutex_lock(&data->task_mutex));
+    int thread = data->next_thread_index++;
+    pthread_assert(pthread_mutex_unlock(&data->task_mutex));
 
     while (1) {
         pthread_assert(pthread_mutex_lock(&data->task_mutex));
@@ -40,36 +92,82 @@ void *process_group_tasks(void *arg) {
         if (task_index >= data->groups_cnt) {
             break;
         }
-        run_group_task(data->context, data->mod, data->col, data->groups[task_index]);
+        uint32_t group = data->groups[task_index];
+        data->task(data->context, data->mod, data->row, data->col, group);
+
+        // Counted by the kernel in a local and published once per group
+        if (data->stats) {
+            add_states(data->stats, thread, t_states_done);
+        }
+        t_states_done = 0;
+    }
+
+    if (VERIFY) {
+        pthread_assert(pthread_mutex_lock(&data->task_mutex));
+        data->checksum_delta += t_checksum_delta;
+        pthread_assert(pthread_mutex_unlock(&data->task_mutex));
     }
     pthread_exit(NULL);
 }
 
-void init_thread_data(thread_pool_data_t *data, const grid_context_t *context, counter_t mod, int col,
-                      uint32_t *groups, uint32_t groups_cnt) {
+void init_thread_data(thread_pool_data_t *data, group_task_t task, const grid_context_t *context,
+                      counter_t mod, int row, int col, uint32_t *groups, uint32_t groups_cnt,
+                      stats_t *stats) {
+    data->task = task;
     data->context = context;
     data->mod = mod;
+    data->row = row;
     data->col = col;
     data->groups = groups;
     data->groups_cnt = groups_cnt;
     data->next_task_index = 0;
+    data->next_thread_index = 0;
+    data->stats = stats;
+    data->checksum_delta = 0;
 
     pthread_assert(pthread_mutex_init(&data->task_mutex, NULL));
 }
 
-void run_threads(pthread_t *threads, thread_pool_data_t *data) {
-    for (int t = 0; t < N_THREADS; t++) {
+void run_threads(pthread_t *threads, int threads_cnt, thread_pool_data_t *data) {
+    for (int t = 0; t < threads_cnt; t++) {
         pthread_assert(pthread_create(&threads[t], NULL, process_group_tasks, (void *)data));
     }
 }
 
-void join_threads(pthread_t *threads) {
-    for (int t = 0; t < N_THREADS; t++) {
+void join_threads(pthread_t *threads, int threads_cnt) {
+    for (int t = 0; t < threads_cnt; t++) {
         pthread_assert(pthread_join(threads[t], NULL));
     }
 }
 
-void process_cell(const grid_context_t *context, counter_t mod, int i) {
+int compare_desc(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x < y) - (x > y);
+}
+
+void order_groups(const grid_context_t *context, uint32_t group_bucket, uint32_t *groups,
+                  uint32_t groups_cnt, int order) {
+    if (order == ORDER_ASCENDING) {
+        for (uint32_t g = 0; g < groups_cnt / 2; g++) {
+            uint32_t t = groups[g];
+            groups[g] = groups[groups_cnt - 1 - g];
+            groups[groups_cnt - 1 - g] = t;
+        }
+    } else if (order == ORDER_LARGEST) {
+        // Largest groups first, so the threads don't wait for a big one queued at the end
+        uint64_t keys[groups_cnt];
+        for (uint32_t g = 0; g < groups_cnt; g++) {
+            keys[g] = ((uint64_t)context->group_cnt[group_bucket][groups[g]] << 32) | groups[g];
+        }
+        qsort(keys, groups_cnt, sizeof(uint64_t), compare_desc);
+        for (uint32_t g = 0; g < groups_cnt; g++) {
+            groups[g] = (uint32_t)keys[g];
+        }
+    }
+}
+
+uint64_t run_group_tasks(group_task_t task, const grid_context_t *context, counter_t mod, int row,
+                         int i, const tuning_t *tuning, stats_t *stats) {
     uint32_t groups[GROUP_CNT];
     uint32_t group_bucket = GROUP_BUCKET(i);
     uint32_t groups_cnt = 0;
@@ -79,79 +177,764 @@ void process_cell(const grid_context_t *context, counter_t mod, int i) {
             groups[groups_cnt++] = g;
         }
     }
+    order_groups(context, group_bucket, groups, groups_cnt, tuning->order);
 
     thread_pool_data_t thread_data;
-    init_thread_data(&thread_data, context, mod, i, groups, groups_cnt);
+    init_thread_data(&thread_data, task, context, mod, row, i, groups, groups_cnt, stats);
 
-    pthread_t threads[N_THREADS];
-    run_threads(threads, &thread_data);
-    join_threads(threads);
+    pthread_t threads[tuning->threads];
+    run_threads(threads, tuning->threads, &thread_data);
+    join_threads(threads, tuning->threads);
 
     pthread_assert(pthread_mutex_destroy(&thread_data.task_mutex));
+    return thread_data.checksum_delta;
+}
+
+uint64_t process_cell(const grid_context_t *context, counter_t mod, int row, int i,
+                      const tuning_t *tuning, stats_t *stats) {
+    return run_group_tasks(run_group_task, context, mod, row, i, tuning, stats);
 }
 
-void run(const grid_context_t *context, counter_t mod) {
+// A path ending in a column left out of the states has no counter, there are no such paths
+uint64_t count_path_end(const grid_context_t *context, counter_t mod, int col) {
+    if (col >= context->cols) {
+        return 0;
+    }
+    uint64_t state = set_state_value(0, col, RIGHT);
+    return get_counter(counters_main_ptr(context, state)) % mod;
+}
+
+void count_endpoints(const grid_context_t *context, counter_t mod, result_t *result) {
+    for (int i = 0; i < N; i++) {
+        result->endpoint_count[i] = count_path_end(context, mod, i);
+    }
+}
+
+// A cell without its edge only takes over the blocked states of the cell before it, there are
+// none when that one had no edge either
+int is_cell_empty(const grid_context_t *context, int row, int col) {
+    return !has_edge(context, row, col) && (col == N - 2 || !has_edge(context, row, col + 1));
+}
+
+void run(const grid_context_t *context, const options_t *options, result_t *result) {
+    counter_t mod = options->mod;
     uint64_t state = set_state_value(0, 0, CYCLES ? BLANK : RIGHT);
-    *counters_main_ptr(context, state) = 1;
+    set_counter(counters_main_ptr(context, state), 1);
+
+    // Counter writes are summed as they happen and compared with the counters after every row
+    snapshot_t *snapshot = options->snapshot;
+    uint64_t checksum = 0;
+    int retries = 0;
+    if (VERIFY) {
+        checksum = counters_checksum(context);
+        if (is_snapshot_row(snapshot, -1)) {
+            save_snapshot(context, snapshot, -1, 0, checksum);
+        }
+    }
 
+    // The states after each row already hold the answer for the k x N grid
     uint64_t count = 0;
     for (int row = 0; row < N; row++) {
+        // Cuts into a missing vertex, or down from one, are dropped before the row starts
+        if (context->obstacle_cut[row]) {
+            checksum +=
+                run_group_tasks(mask_group_task, context, mod, row, 0, &options->tuning, NULL);
+        }
+
+        // Most Hamiltonian states cannot be completed by the last row alone; zeroing them skips
+        // about 60% of the state visits of that row, a few percent of the run
+        if (HAMILTONIAN && row == N - 1) {
+            checksum +=
+                run_group_tasks(prune_group_task, context, mod, row, 0, &options->tuning, NULL);
+        }
+
         for (int col = N - 2; col >= 0; col--) {
-            printf("counting = %d/%d (%d) \r", row + 1, N, N - col);
-            fflush(stdout);
+            if (options->progress) {
+                printf("counting = %d/%d (%d) \r", row + 1, N, N - col);
+                fflush(stdout);
+            }
 
-            if (CYCLES && (!HAMILTONIAN || (row == N - 1 && col == 0))) {
+            if (CYCLES && (!HAMILTONIAN || col == 0) && has_edge(context, row, col)) {
                 state = set_state_pair(0, col, PAIR(RIGHT, LEFT));
-                count += *counters_main_ptr(context, state);
-                count %= mod;
+                uint64_t closed = get_counter(counters_main_ptr(context, state)) % mod;
+                count = HAMILTONIAN ? closed : (count + closed) % mod;
+            }
+            start_cell(options->stats, row, col);
+            if (!is_cell_empty(context, row, col)) {
+                checksum += process_cell(context, mod, row, col, &options->tuning, options->stats);
+            }
+            finish_cell(options->stats);
+        }
+
+        if (!CYCLES) {
+            count = count_path_end(context, mod, N - 1);
+        }
+        result->row_count[row] = count;
+
+        if (VERIFY) {
+            // Retries are counted from the last copy, the rows after it are repeated with it
+            if (counters_checksum(context) == checksum) {
+                if (is_snapshot_row(snapshot, row)) {
+                    save_snapshot(context, snapshot, row, count, checksum);
+                    retries = 0;
+                }
+                continue;
             }
-            process_cell(context, mod, col);
+            if (++retries > VERIFY_RETRIES || !restore_snapshot(context, snapshot)) {
+                fprintf(stderr, "\ncounters are corrupted in row %d\n", row + 1);
+                exit(EXIT_FAILURE);
+            }
+            fprintf(stderr, "\nchecksum mismatch in row %d, restarting from row %d\n", row + 1,
+                    snapshot->row + 2);
+
+            row = snapshot->row;
+            count = snapshot->count;
+            checksum = snapshot->checksum;
         }
     }
 
+    result->count = count;
     if (!CYCLES) {
-        state = set_state_value(0, N - 1, RIGHT);
-        count = *counters_main_ptr(context, state) % mod;
+        count_endpoints(context, mod, result);
+    }
+}
+
+void print_solution(uint64_t count, counter_t mod) {
+    printf("\nsolution = %" PRIu64 " mod %" PRIu64 "\n\n", count, (uint64_t)mod);
+}
+
+void print_reconstructed(const uint64_t *residues, const uint64_t *mods, int mods_cnt) {
+    crt_t crt;
+    crt_init(&crt);
+
+    for (int i = 0; i < mods_cnt; i++) {
+        crt_add(&crt, residues[i], mods[i]);
+    }
+    big_print(&crt.value);
+    printf("\n");
+}
+
+// A count of a single run is printed as its residue, the CRT driver combines the residues
+void print_residues(const uint64_t *residues, const uint64_t *mods, int mods_cnt, int crt) {
+    if (crt) {
+        print_reconstructed(residues, mods, mods_cnt);
+    } else {
+        printf("%" PRIu64 " mod %" PRIu64 "\n", residues[0], mods[0]);
+    }
+}
+
+// Prints the --rows and --endpoints counts of the results of all moduli, separated by an empty
+// line
+void print_counts(const result_t *results, const uint64_t *mods, int mods_cnt,
+                  const options_t *options) {
+    uint64_t residues[mods_cnt];
+
+    if (options->rows) {
+        for (int row = 0; row < N; row++) {
+            for (int i = 0; i < mods_cnt; i++) {
+                residues[i] = results[i].row_count[row];
+            }
+            printf("%2d x %d  = ", row + 1, N);
+            print_residues(residues, mods, mods_cnt, options->crt);
+        }
+    }
+    if (options->rows && options->endpoints) {
+        printf("\n");
     }
+    if (options->endpoints) {
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < mods_cnt; j++) {
+                residues[j] = results[j].endpoint_count[i];
+            }
+            printf("(%2d, %2d) = ", N - 1, i);
+            print_residues(residues, mods, mods_cnt, options->crt);
+        }
+        // The grid is square, so the last column mirrors the last row unless a mask breaks the
+        // symmetry
+        for (int i = 0; i < N - 1 && !options->mask; i++) {
+            for (int j = 0; j < mods_cnt; j++) {
+                residues[j] = results[j].endpoint_count[i];
+            }
+            printf("(%2d, %2d) = ", i, N - 1);
+            print_residues(residues, mods, mods_cnt, options->crt);
+        }
+    }
+}
 
-    printf("\nsolution = %llu mod %llu\n\n", count, (uint64_t)mod);
+void print_result(const result_t *result, const options_t *options) {
+    uint64_t mod = options->mod;
+
+    if (options->progress && (options->rows || options->endpoints)) {
+        printf("\n");
+    }
+    if (options->rows || options->endpoints) {
+        printf("\n");
+    }
+    print_counts(result, &mod, 1, options);
+    print_solution(result->count, options->mod);
 }
 
-counter_t parse_mod(int argc, const char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <mod>\n", argv[0]);
+int max_jobs(const grid_context_t *context, const snapshot_t *snapshot, int jobs) {
+    uint64_t job_memory = COUNTERS_SIZE(context->counters_cnt + context->blocked_cnt) *
+                          (snapshot && snapshot->copy ? 2 : 1);
+    uint64_t available = available_memory();
+
+    // Forked jobs share the tables, but every job writes its own copy of the counters
+    uint64_t fit = job_memory ? available / job_memory : jobs;
+    if (fit < (uint64_t)jobs) {
+        jobs = fit > 0 ? fit : 1;
+        printf("jobs     = %d (limited by memory)\n\n", jobs);
+    }
+    return jobs;
+}
+
+typedef struct {
+    int index;
+    result_t result;
+} job_record_t;
+
+void run_jobs(const grid_context_t *context, const options_t *options, const uint64_t *mods,
+              int mods_cnt, result_t *results) {
+    int jobs = max_jobs(context, options->snapshot,
+                        options->jobs < mods_cnt ? options->jobs : mods_cnt);
+
+    if (jobs == 1) {
+        for (int i = 0; i < mods_cnt; i++) {
+            options_t job = *options;
+            job.mod = mods[i];
+
+            run(context, &job, &results[i]);
+            reset_counters(context);
+
+            if (job.progress) {
+                printf("\n");
+            }
+            print_solution(results[i].count, job.mod);
+        }
+        return;
+    }
+
+    int fd[2];
+    if (pipe(fd) != 0) {
+        perror("pipe");
         exit(EXIT_FAILURE);
     }
+    fflush(stdout);
 
-    char *endptr;
-    uint64_t mod = strtoull(argv[1], &endptr, 10);
+    pid_t pids[jobs];
+    for (int j = 0; j < jobs; j++) {
+        pids[j] = fork();
+        if (pids[j] < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pids[j] > 0) {
+            continue;
+        }
+
+        // Records are smaller than PIPE_BUF, so writes from different jobs never interleave
+        close(fd[0]);
+        for (int i = j; i < mods_cnt; i += jobs) {
+            options_t job = *options;
+            job.mod = mods[i];
+
+            job_record_t record = {.index = i};
+            run(context, &job, &record.result);
+            reset_counters(context);
+
+            if (write(fd[1], &record, sizeof(record)) != sizeof(record)) {
+                _exit(EXIT_FAILURE);
+            }
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    close(fd[1]);
+
+    int received = 0;
+    job_record_t record;
+    while (read(fd[0], &record, sizeof(record)) == sizeof(record)) {
+        results[record.index] = record.result;
+        print_solution(record.result.count, mods[record.index]);
+        fflush(stdout);
+        received++;
+    }
+    close(fd[0]);
+
+    for (int j = 0; j < jobs; j++) {
+        int status;
+        waitpid(pids[j], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            received = -1;
+        }
+    }
+    if (received != mods_cnt) {
+        fprintf(stderr, "counting job failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void run_crt(const grid_context_t *context, const options_t *options) {
+    uint64_t mods[64];
+    int bound_bits = count_bound_bits(options->tuning.threads);
+    int mods_cnt = select_mods(mods, COUNTER_BITS, bound_bits);
+
+    if (mods_cnt == 0) {
+        fprintf(stderr, "not enough %d-bit moduli to exceed 2^%d\n", COUNTER_BITS, bound_bits);
+        exit(EXIT_FAILURE);
+    }
+    printf("moduli   = %d (bound 2^%d)\n\n", mods_cnt, bound_bits);
+
+    result_t results[mods_cnt];
+    expect_runs(options->stats, mods_cnt);
+    run_jobs(context, options, mods, mods_cnt, results);
+
+    print_counts(results, mods, mods_cnt, options);
+    if (options->rows || options->endpoints) {
+        printf("\n");
+    }
+
+    uint64_t residues[mods_cnt];
+    for (int i = 0; i < mods_cnt; i++) {
+        residues[i] = results[i].count;
+    }
+    printf("result = ");
+    print_reconstructed(residues, mods, mods_cnt);
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--threads <threads>] [--tables <file>] [--mask <file>] "
+            "[--stats <file>] [--rows] [--endpoints] <mod>\n", name);
+    fprintf(stderr, "       %s [--threads <threads>] [--tables <file>] [--stats <file>] [--rows] "
+            "[--endpoints] --server\n", name);
+    fprintf(stderr, "       %s [--threads <threads>] [--tables <file>] [--stats <file>] [--rows] "
+            "[--endpoints] --crt [--jobs <jobs>]\n", name);
+    fprintf(stderr, "       %s --tune\n", name);
+    fprintf(stderr, "       %s --plan [--memory <MB>]\n", name);
+    if (VERIFY) {
+        fprintf(stderr, "counting also takes [--snapshot <file>] [--snapshot-rows <rows>]\n");
+    }
+    exit(EXIT_FAILURE);
+}
 
-    int bits = sizeof(counter_t) * 8;
+uint64_t max_mod() {
+    int bits = COUNTER_BITS;
     int bound_bits = bits < 64 ? bits : bits - 1;
 
-    uint64_t max_mod = (1ULL << bound_bits) - 1;
-    if (mod == 0 || mod > max_mod) {
-        fprintf(stderr, "mod is out of range (0, %llu]\n", max_mod);
+    return (1ULL << bound_bits) - 1;
+}
+
+int parse_mod(const char *arg, counter_t *mod) {
+    char *endptr;
+    uint64_t value = strtoull(arg, &endptr, 10);
+
+    if (*endptr != '\0' || value == 0 || value > max_mod()) {
+        return 0;
+    }
+
+    *mod = (counter_t)value;
+    return 1;
+}
+
+void serve(const grid_context_t *context, const options_t *options) {
+    char line[64];
+
+    // One modulus per line; the context is built once and only counters are reset between jobs
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        char *arg = line + strspn(line, " \t");
+        arg[strcspn(arg, " \t\r\n")] = '\0';
+        if (arg[0] == '\0') {
+            continue;
+        }
+
+        options_t job = *options;
+        if (!parse_mod(arg, &job.mod)) {
+            printf("\nerror = mod %s is out of range (0, %" PRIu64 "]\n\n", arg, max_mod());
+        } else {
+            result_t result;
+            expect_runs(job.stats, 1);
+            run(context, &job, &result);
+            reset_counters(context);
+            print_result(&result, &job);
+        }
+        fflush(stdout);
+    }
+}
+
+double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+void run_tune(const grid_context_t *context, const options_t *options) {
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads_list[32], threads_cnt = 0;
+    for (int t = 1; t < cpus && threads_cnt < 31; t *= 2) {
+        threads_list[threads_cnt++] = t;
+    }
+    threads_list[threads_cnt++] = cpus;
+
+    // Timing only, the largest modulus exercises the same addition path as the CRT primes
+    options_t job = *options;
+    job.mod = max_mod();
+    job.progress = 0;
+    job.stats = NULL;
+
+    // The first run only faults the counters in
+    result_t result;
+    run(context, &job, &result);
+    reset_counters(context);
+
+    tuning_t best = options->tuning;
+    double best_time = 0, single_time = 0;
+
+    printf("threads  order       runs     time\n");
+    for (int i = 0; i < threads_cnt; i++) {
+        for (int order = 0; order < ORDER_CNT; order++) {
+            job.tuning.threads = threads_list[i];
+            job.tuning.order = order;
+
+            // A single run is at the mercy of whatever else the machine does
+            double time = 0, total = 0;
+            int runs = 0;
+            while (runs < TUNE_MIN_RUNS || total < TUNE_MIN_SECONDS) {
+                struct timespec start;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                run(context, &job, &result);
+                double t = seconds_since(&start);
+                reset_counters(context);
+
+                time = runs == 0 || t < time ? t : time;
+                total += t;
+                runs++;
+            }
+
+            printf("%7d  %-10s  %4d  %7.3fs\n", job.tuning.threads, order_name(order), runs, time);
+            fflush(stdout);
+
+            if (job.tuning.threads == 1 && (single_time == 0 || time < single_time)) {
+                single_time = time;
+            }
+            if (best_time == 0 || time < best_time) {
+                best = job.tuning, best_time = time;
+            }
+        }
+    }
+
+    // Same per-state cost model as the planner
+    best.ns_per_state = single_time * 1e9 / ((double)context->counters_cnt * N * (N - 1));
+
+    const char *path = profile_path();
+    printf("\nthreads  = %d\n", best.threads);
+    printf("order    = %s\n", order_name(best.order));
+    printf("ns/state = %.3f\n", best.ns_per_state);
+    if (!save_profile(path, &best)) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    printf("profile  = %s\n", path);
+}
+
+// Marks the edge between two adjacent vertices as missing
+int add_missing_edge(mask_t *mask, int r1, int c1, int r2, int c2) {
+    if (r1 > r2 || (r1 == r2 && c1 > c2)) {
+        return add_missing_edge(mask, r2, c2, r1, c1);
+    }
+    int right = r2 == r1 && c2 == c1 + 1, down = r2 == r1 + 1 && c2 == c1;
+    if (r1 < 0 || c1 < 0 || r2 >= N || c2 >= N || !(right || down)) {
+        return 0;
+    }
+
+    if (right) {
+        mask->right[r1] |= 1U << c1;
+    } else {
+        mask->down[r1] |= 1U << c1;
+    }
+    return 1;
+}
+
+int read_mask(const char *path, mask_t *mask, int *missing_edges_cnt) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    // One line per row, '#' marks a missing vertex and '.' a present one
+    char line[64];
+    int missing_cnt = 0, row = 0;
+    while (row < N && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strlen(line) != N || strspn(line, ".#") != N) {
+            fprintf(stderr, "%s: row %d has to be %d characters '.' or '#'\n", path, row + 1, N);
+            exit(EXIT_FAILURE);
+        }
+
+        mask->vertices[row] = 0;
+        for (int col = 0; col < N; col++) {
+            if (line[col] == '#') {
+                mask->vertices[row] |= 1U << col;
+                missing_cnt++;
+            }
+        }
+        row++;
+    }
+
+    if (row != N) {
+        fprintf(stderr, "%s: %d rows expected\n", path, N);
+        exit(EXIT_FAILURE);
+    }
+
+    // Then one line per missing edge, the row and column of both of its vertices
+    *missing_edges_cnt = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int r1, c1, r2, c2;
+        if (strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+        if (sscanf(line, "%d %d %d %d", &r1, &c1, &r2, &c2) != 4 ||
+            !add_missing_edge(mask, r1, c1, r2, c2)) {
+            fprintf(stderr, "%s: an edge has to be given as 'row col row col' of two adjacent "
+                    "vertices\n", path);
+            exit(EXIT_FAILURE);
+        }
+        (*missing_edges_cnt)++;
+    }
+    fclose(f);
+
+    return missing_cnt;
+}
+
+void parse_args(options_t *options, int argc, char *const argv[]) {
+    static const struct option long_options[] = {
+        {"rows", no_argument, NULL, 'r'},
+        {"endpoints", no_argument, NULL, 'e'},
+        {"server", no_argument, NULL, 's'},
+        {"crt", no_argument, NULL, 'c'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"threads", required_argument, NULL, 't'},
+        {"mask", required_argument, NULL, 'x'},
+        {"tables", required_argument, NULL, 'T'},
+        {"stats", required_argument, NULL, 'l'},
+        {"tune", no_argument, NULL, 'u'},
+        {"plan", no_argument, NULL, 'p'},
+        {"memory", required_argument, NULL, 'm'},
+        {"snapshot", required_argument, NULL, 'S'},
+        {"snapshot-rows", required_argument, NULL, 'k'},
+        {NULL, 0, NULL, 0},
+    };
+
+    options->mod = 0;
+    options->rows = 0;
+    options->endpoints = 0;
+    options->server = 0;
+    options->crt = 0;
+    options->jobs = 1;
+    options->tuning.threads = N_THREADS;
+    options->tuning.order = ORDER_DESCENDING;
+    options->tuning.ns_per_state = 0;
+    options->tune = 0;
+    options->plan = 0;
+    options->memory = 0;
+    options->tables = NULL;
+    options->mask = NULL;
+    options->missing_cnt = options->missing_edges_cnt = 0;
+    options->symmetry = 0;
+    memset(&options->missing, 0, sizeof(options->missing));
+    options->stats_path = NULL;
+    options->stats = NULL;
+    options->snapshot_path = NULL;
+    options->snapshot_rows = 1;
+    options->snapshot = NULL;
+
+    // A tuning profile replaces the built-in defaults, explicit options still take precedence
+    options->profile = load_profile(profile_path(), &options->tuning);
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "rescj:t:x:T:l:upm:S:k:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            options->rows = 1;
+            break;
+        case 'e':
+            if (CYCLES) {
+                fprintf(stderr, "endpoints are only defined for paths\n");
+                exit(EXIT_FAILURE);
+            }
+            options->endpoints = 1;
+            break;
+        case 's':
+            options->server = 1;
+            break;
+        case 'c':
+            options->crt = 1;
+            break;
+        case 'j':
+            options->jobs = atoi(optarg);
+            if (options->jobs < 1) {
+                usage(argv[0]);
+            }
+            break;
+        case 't':
+            options->tuning.threads = atoi(optarg);
+            if (options->tuning.threads < 1) {
+                usage(argv[0]);
+            }
+            break;
+        case 'x':
+            if (HAMILTONIAN) {
+                fprintf(stderr, "obstacles are not supported for Hamiltonian cycles\n");
+                exit(EXIT_FAILURE);
+            }
+            options->mask = optarg;
+            options->missing_cnt =
+                read_mask(optarg, &options->missing, &options->missing_edges_cnt);
+            break;
+        case 'T':
+            options->tables = optarg;
+            break;
+        case 'l':
+            options->stats_path = optarg;
+            break;
+        case 'u':
+            options->tune = 1;
+            break;
+        case 'p':
+            options->plan = 1;
+            break;
+        case 'm':
+            options->memory = strtoull(optarg, NULL, 10) << 20;
+            break;
+        case 'S':
+        case 'k':
+            if (!VERIFY) {
+                fprintf(stderr, "snapshots are only kept by a VERIFY build\n");
+                exit(EXIT_FAILURE);
+            }
+            if (opt == 'S') {
+                options->snapshot_path = optarg;
+            } else if ((options->snapshot_rows = atoi(optarg)) < 0) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    // Under a stats file the progress is watched from outside, stdout only gets the results
+    options->progress = !options->server && options->jobs == 1 && !options->stats_path;
+    if (options->server + options->crt + options->tune + options->plan > 1) {
+        usage(argv[0]);
+    }
+    // Only the CRT moduli are split between jobs
+    if (options->jobs != 1 && !options->crt) {
+        usage(argv[0]);
+    }
+    // Forked jobs would overwrite each other's snapshot file
+    if (options->snapshot_path && options->jobs != 1) {
+        fprintf(stderr, "a snapshot file can't be shared by jobs\n");
+        exit(EXIT_FAILURE);
+    }
+    // A mask breaks the symmetry that gives the last column from the last row
+    if (options->endpoints && options->mask) {
+        fprintf(stderr, "endpoints are only counted without a mask\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options->server || options->crt || options->tune || options->plan) {
+        if (optind != argc) {
+            usage(argv[0]);
+        }
+        return;
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    if (!parse_mod(argv[optind], &options->mod)) {
+        fprintf(stderr, "mod is out of range (0, %" PRIu64 "]\n", max_mod());
         exit(EXIT_FAILURE);
     }
+}
 
-    return (counter_t)mod;
+// Cycles are counted the same in any orientation of the grid, the rows and the path ends are not
+void orient(options_t *options) {
+    if (options->mask && CYCLES && !options->rows) {
+        options->symmetry = orient_mask(&options->missing);
+    }
 }
 
-void print_config(counter_t mod) {
+void print_config(const options_t *options) {
     printf("N        = %d\n", N);
-    printf("bits     = %d\n", (int)(sizeof(counter_t) * 8));
+    printf("bits     = %d\n", COUNTER_BITS);
     printf("cycles   = %s %s\n", CYCLES ? "yes" : "no", HAMILTONIAN ? "(hamiltonian)" : "");
-    printf("threads  = %d\n", N_THREADS);
-    printf("mod      = %llu\n", (uint64_t)mod);
+    printf("threads  = %d\n", options->tuning.threads);
+    if (VERIFY) {
+        printf("verify   = yes\n");
+    }
+    if (options->mask) {
+        printf("mask     = %s (%d missing, %d missing edges)\n", options->mask,
+               options->missing_cnt, options->missing_edges_cnt);
+        if (options->symmetry) {
+            printf("oriented =%s%s%s\n", options->symmetry & 1 ? " transposed" : "",
+                   options->symmetry & 2 ? " flipped-rows" : "",
+                   options->symmetry & 4 ? " flipped-columns" : "");
+        }
+        if (mask_columns(&options->missing) < N) {
+            printf("columns  = %d\n", mask_columns(&options->missing));
+        }
+    }
+    if (options->stats_path) {
+        printf("stats    = %s\n", options->stats_path);
+    }
+    if (options->profile) {
+        printf("profile  = %s\n", profile_path());
+    }
+    if (options->crt) {
+        printf("jobs     = %d\n", options->jobs);
+    } else if (options->mod) {
+        printf("mod      = %" PRIu64 "\n", (uint64_t)options->mod);
+    }
 }
 
-int main(int argc, const char *argv[]) {
-    counter_t mod = parse_mod(argc, argv);
-    print_config(mod);
+int main(int argc, char *argv[]) {
+    options_t options;
+    parse_args(&options, argc, argv);
+    orient(&options);
+    print_config(&options);
 
-    const grid_context_t *context = init();
-    run(context, mod);
+    if (options.plan) {
+        printf("\n");
+        plan(options.memory, options.tuning.ns_per_state, COUNTER_BITS);
+        return 0;
+    }
+
+    // Opened before the tables are built, so a reader sees the run from its start
+    if (options.stats_path) {
+        options.stats = open_stats(options.stats_path, options.tuning.threads);
+    }
+
+    grid_context_t *context = init(options.tables, &options.missing);
+    set_obstacles(context, &options.missing);
+    if (VERIFY) {
+        options.snapshot = open_snapshot(context, options.snapshot_path, options.snapshot_rows);
+    }
+    printf("\n");
+
+    if (options.server) {
+        fflush(stdout);
+        serve(context, &options);
+    } else if (options.crt) {
+        run_crt(context, &options);
+    } else if (options.tune) {
+        run_tune(context, &options);
+    } else {
+        result_t result;
+        expect_runs(options.stats, 1);
+        run(context, &options, &result);
+        print_result(&result, &options);
+    }
 
+    finish_stats(options.stats);
     return 0;
 }
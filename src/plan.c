@@ -0,0 +1,134 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "crt.h"
+#include "init.h"
+#include "plan.h"
+#include "report.h"
+
+// Widths the planner considers, the bit-sliced ones first
+const int plan_bits[] = {2, 3, 4, 5, 6, 7, 8, 16, 32, 64};
+#define PLAN_BITS_CNT (sizeof(plan_bits) / sizeof(plan_bits[0]))
+
+// Single-threaded cost of one state in one cell for each of plan_bits, measured for N = 18. A
+// single thread is bound by the table lookups, so the width of whole counters barely shows here;
+// sliced counters are 2-5x slower, they only pay off when nothing wider fits.
+const double plan_ns_per_state[] = {6.1, 9.0, 9.8, 11.4, 13.1, 15.0, 3.0, 2.9, 3.0, 3.0};
+
+// Every state reads its counter and its source and writes the counter about once per cell; all
+// threads share the memory bandwidth, which is where the width of the counters shows
+#define PLAN_ACCESSES_PER_STATE 3
+#define PLAN_BANDWIDTH_GBS 20
+
+int bits_index(int bits) {
+    for (uint32_t i = 0; i < PLAN_BITS_CNT; i++) {
+        if (plan_bits[i] == bits) {
+            return i;
+        }
+    }
+    return PLAN_BITS_CNT - 1;
+}
+
+// Time of one modulus with the given counter width
+double count_time(uint64_t states_cnt, int bits, int threads, double ns_per_state) {
+    double cells = (double)N * (N - 1);
+    double compute = ns_per_state * 1e-9 * states_cnt / threads;
+    double traffic = (double)states_cnt * bits / 8 * PLAN_ACCESSES_PER_STATE /
+                     (PLAN_BANDWIDTH_GBS * 1e9);
+    return cells * (compute > traffic ? compute : traffic);
+}
+
+void plan(uint64_t memory, double measured_ns_per_state, int measured_bits) {
+    grid_sizes_t sizes;
+    init_sizes(&sizes);
+
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (memory == 0) {
+        memory = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    }
+
+    // A cost measured by --tune on this machine replaces the calibrated ones, scaled to the other
+    // widths as they relate to each other
+    int measured = measured_ns_per_state > 0;
+    double scale = 1;
+    if (measured) {
+        scale = measured_ns_per_state / plan_ns_per_state[bits_index(measured_bits)];
+    }
+
+    uint64_t states_cnt = sizes.counters_cnt + sizes.blocked_cnt;
+    int bound_bits = count_bound_bits(cpus);
+
+    printf("states   = %" PRIu64 " (%" PRIu64 " blocked)\n", sizes.counters_cnt, sizes.blocked_cnt);
+    printf("tables   = %" PRIu64 "MB (+%" PRIu64 "MB during init)\n", MB(sizes.tables_size),
+           MB(sizes.tmp_size));
+    printf("bound    = 2^%d\n", bound_bits);
+    printf("machine  = %d cpus, %" PRIu64 "MB, %dGB/s assumed", cpus, MB(memory),
+           PLAN_BANDWIDTH_GBS);
+    if (measured) {
+        printf(", %.2fns/state measured with %d bits", measured_ns_per_state, measured_bits);
+    }
+    printf("\n\n");
+    printf("bits      memory  moduli  jobs  threads  ns/state  time\n");
+
+    int best_bits = 0, best_jobs = 0, best_threads = 0, best_snapshot = 0;
+    double best_time = 0;
+
+    for (uint32_t b = 0; b < PLAN_BITS_CNT; b++) {
+        int bits = plan_bits[b];
+
+        // A verifying build keeps a snapshot of the counters next to them when it fits, it has
+        // to go to a file otherwise
+        uint64_t counters_size = states_cnt * bits / 8;
+        int snapshot = VERIFY && sizes.tables_size + 2 * counters_size <= memory;
+        counters_size *= snapshot ? 2 : 1;
+        uint64_t peak = sizes.tables_size +
+                        (counters_size > sizes.tmp_size ? counters_size : sizes.tmp_size);
+
+        uint64_t mods[64];
+        int mods_cnt = select_mods(mods, bits, bound_bits);
+
+        printf("%4d  %8" PRIu64 "MB", bits, MB(peak));
+        if (peak > memory || mods_cnt == 0) {
+            printf("  %s\n", mods_cnt ? "does not fit" : "not enough moduli");
+            continue;
+        }
+
+        // Forked jobs share the tables, each one holds its own counters next to the parent's
+        uint64_t fit = (memory - sizes.tables_size) / counters_size;
+        int jobs = fit > 2 ? fit - 1 : 1;
+        jobs = jobs < mods_cnt ? jobs : mods_cnt;
+        jobs = jobs < cpus ? jobs : cpus;
+        // A snapshot file isn't shared between jobs
+        jobs = VERIFY && !snapshot ? 1 : jobs;
+        int threads = cpus / jobs;
+
+        // Jobs running at once share the bandwidth as well as the cpus
+        double ns_per_state = scale * plan_ns_per_state[b];
+        double time = ((mods_cnt + jobs - 1) / jobs) *
+                      count_time(sizes.counters_cnt * jobs, bits, threads * jobs, ns_per_state);
+        printf("  %6d  %4d  %7d  %8.2f  ", mods_cnt, jobs, threads, ns_per_state);
+        print_duration(time);
+        printf("%s\n", VERIFY && !snapshot ? "  (--snapshot <file>)" : "");
+
+        if (best_bits == 0 || time < best_time) {
+            best_bits = bits, best_jobs = jobs, best_threads = threads, best_time = time;
+            best_snapshot = snapshot;
+        }
+    }
+
+    if (best_bits == 0) {
+        printf("\nno configuration fits in %" PRIu64 "MB\n", MB(memory));
+        return;
+    }
+    printf("\nmake N=%d BITS=%d CYCLES=%d HAMILTONIAN=%d N_THREADS=%d\n", N, best_bits, CYCLES,
+           HAMILTONIAN, best_threads);
+    printf("./path-counter --crt --jobs %d%s\n", best_jobs,
+           VERIFY && !best_snapshot ? " --snapshot <file>" : "");
+}
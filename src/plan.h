@@ -0,0 +1,9 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include "defs.h"
+
+void plan(uint64_t, double, int);
@@ -0,0 +1,35 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "report.h"
+
+uint64_t realtime_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint64_t available_memory() {
+#ifdef _SC_AVPHYS_PAGES
+    return (uint64_t)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+#else
+    return (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void print_duration(double seconds) {
+    if (seconds >= 3600) {
+        printf("%.1fh", seconds / 3600);
+    } else if (seconds >= 60) {
+        printf("%.1fm", seconds / 60);
+    } else {
+        printf("%.1fs", seconds);
+    }
+}
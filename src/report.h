@@ -0,0 +1,14 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <stdint.h>
+
+// Doesn't depend on N or BITS, path-counter-top links it without a build configuration
+#define MB(size) ((size) / (1 << 20))
+
+uint64_t realtime_ns();
+uint64_t available_memory();
+void print_duration(double);
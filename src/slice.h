@@ -0,0 +1,236 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+// Bit-sliced counters, included by inline.h when SLICE_BITS is set. Every block of 64 consecutive
+// counters is stored as SLICE_BITS words, word i holding bit i of all of them, so a residue takes
+// SLICE_BITS bits and the additions of two ranges are adder networks over whole words. Counters
+// are addressed by their index, main and blocked counters are two ranges of the same planes.
+
+#define SLICE_LANES 64
+
+extern uint64_t *g_slices;
+extern uint64_t g_slices_cnt;
+
+inline uint64_t *slice_block(counter_ptr_t p) {
+    return g_slices + (p / SLICE_LANES) * SLICE_BITS;
+}
+
+inline uint64_t lanes_mask(uint32_t n) {
+    return n == SLICE_LANES ? ~0ULL : (1ULL << n) - 1;
+}
+
+inline counter_t get_counter(counter_ptr_t p) {
+    const uint64_t *w = slice_block(p);
+    int s = p % SLICE_LANES;
+
+    counter_t v = 0;
+    for (int i = 0; i < SLICE_BITS; i++) {
+        v |= ((w[i] >> s) & 1) << i;
+    }
+    return v;
+}
+
+inline void set_counter(counter_ptr_t p, counter_t v) {
+    uint64_t *w = slice_block(p);
+    uint64_t bit = 1ULL << (p % SLICE_LANES);
+
+    for (int i = 0; i < SLICE_BITS; i++) {
+        w[i] = (w[i] & ~bit) | (-(uint64_t)((v >> i) & 1) & bit);
+    }
+}
+
+// Plane i of the 64 lanes starting at p, the ones past its block come from the next block; one
+// block of padding keeps the last read inside the planes
+inline uint64_t slice_load(counter_ptr_t p, int i) {
+    const uint64_t *w = slice_block(p);
+    int s = p % SLICE_LANES;
+    return s ? (w[i] >> s) | (w[i + SLICE_BITS] << (SLICE_LANES - s)) : w[i];
+}
+
+// Writes the low n lanes of x to the n lanes starting at p
+inline void slice_store(counter_ptr_t p, uint32_t n, const uint64_t *x) {
+    uint64_t *w = slice_block(p);
+    int s = p % SLICE_LANES;
+
+    uint64_t lo = lanes_mask(n) << s;
+    for (int i = 0; i < SLICE_BITS; i++) {
+        w[i] = (w[i] & ~lo) | ((x[i] << s) & lo);
+    }
+    if (s && n > (uint32_t)(SLICE_LANES - s)) {
+        uint64_t hi = lanes_mask(n) >> (SLICE_LANES - s);
+        for (int i = 0; i < SLICE_BITS; i++) {
+            w[i + SLICE_BITS] = (w[i + SLICE_BITS] & ~hi) | ((x[i] >> (SLICE_LANES - s)) & hi);
+        }
+    }
+}
+
+// Sum of the lanes in mask, weighted by their planes
+inline uint64_t slice_sum(const uint64_t *x, uint64_t mask) {
+    uint64_t sum = 0;
+    for (int i = 0; i < SLICE_BITS; i++) {
+        sum += (uint64_t)__builtin_popcountll(x[i] & mask) << i;
+    }
+    return sum;
+}
+
+// r = a + b mod m in every lane: a ripple-carry adder, then a subtractor of the constant m whose
+// result is taken where the sum exceeds m. As with _add_mod, counters stay in [0, m] and a non-zero
+// counter never becomes zero, which the kernels rely on, so m < 2^SLICE_BITS.
+inline void slice_add(uint64_t *r, const uint64_t *a, const uint64_t *b, counter_t mod) {
+    uint64_t s[SLICE_BITS], t[SLICE_BITS], carry = 0, borrow = 0;
+
+    for (int i = 0; i < SLICE_BITS; i++) {
+        uint64_t x = a[i] ^ b[i];
+        s[i] = x ^ carry;
+        carry = (a[i] & b[i]) | (x & carry);
+    }
+    for (int i = 0; i < SLICE_BITS; i++) {
+        uint64_t m = -(uint64_t)((mod >> i) & 1);
+        uint64_t x = s[i] ^ m;
+        t[i] = x ^ borrow;
+        borrow = (~s[i] & m) | (~x & borrow);
+    }
+
+    uint64_t nonzero = 0;
+    for (int i = 0; i < SLICE_BITS; i++) {
+        nonzero |= t[i];
+    }
+    uint64_t reduce = carry | (~borrow & nonzero);
+    for (int i = 0; i < SLICE_BITS; i++) {
+        r[i] = (t[i] & reduce) | (s[i] & ~reduce);
+    }
+}
+
+enum { SLICE_ADD, SLICE_RESET, SLICE_SET_SRC };
+
+// Ranges up to this length are added one counter at a time, the adder network pays off above it
+#define SLICE_SCALAR_MAX 2
+
+// Same as slice_range for a single counter, returns the change of the counter sum
+inline uint64_t slice_one(counter_ptr_t dest, counter_ptr_t src, counter_t mod, int op) {
+    counter_t d = get_counter(dest), s = get_counter(src);
+    counter_t v = s;
+    if (!HAMILTONIAN || op == SLICE_ADD) {
+        v = d + s > mod ? d + s - mod : d + s;
+    }
+    set_counter(dest, v);
+
+    uint64_t delta = (uint64_t)v - d;
+    if (op != SLICE_ADD) {
+        set_counter(src, op == SLICE_SET_SRC ? d : 0);
+        delta += (op == SLICE_SET_SRC ? (uint64_t)d : 0) - s;
+    }
+    return delta;
+}
+
+// dest += src over len counters; SLICE_RESET clears src and SLICE_SET_SRC moves the old dest
+// there, both take src over instead of adding it for Hamiltonian cycles. Runs of lanes that share
+// a block of dest are done at once, src is shifted into their lanes.
+inline void slice_range(uint32_t len, counter_ptr_t dest, counter_ptr_t src, counter_t mod,
+                        int op) {
+    uint64_t delta = 0;
+
+    if (len <= SLICE_SCALAR_MAX) {
+        for (uint32_t j = 0; j < len; j++) {
+            delta += slice_one(dest + j, src + j, mod, op);
+        }
+        track(delta);
+        return;
+    }
+
+    for (uint32_t done = 0, n; done < len; done += n, dest += n, src += n) {
+        int s = dest % SLICE_LANES;
+        n = SLICE_LANES - s < len - done ? SLICE_LANES - s : len - done;
+        uint64_t mask = lanes_mask(n) << s;
+
+        uint64_t *w = slice_block(dest);
+        uint64_t a[SLICE_BITS], b[SLICE_BITS], r[SLICE_BITS], x[SLICE_BITS];
+        for (int i = 0; i < SLICE_BITS; i++) {
+            a[i] = w[i];
+            b[i] = slice_load(src, i) << s;
+        }
+
+        if (HAMILTONIAN && op != SLICE_ADD) {
+            for (int i = 0; i < SLICE_BITS; i++) {
+                r[i] = b[i];
+            }
+        } else {
+            slice_add(r, a, b, mod);
+        }
+        for (int i = 0; i < SLICE_BITS; i++) {
+            w[i] = (a[i] & ~mask) | (r[i] & mask);
+        }
+
+        if (op != SLICE_ADD) {
+            for (int i = 0; i < SLICE_BITS; i++) {
+                x[i] = op == SLICE_SET_SRC ? a[i] >> s : 0;
+            }
+            slice_store(src, n, x);
+        }
+
+        if (VERIFY) {
+            delta += slice_sum(r, mask) - slice_sum(a, mask);
+            if (op != SLICE_ADD) {
+                delta += slice_sum(x, lanes_mask(n)) - slice_sum(b, mask);
+            }
+        }
+    }
+    track(delta);
+}
+
+inline int is_zero(counter_ptr_t counters, uint32_t len) {
+    for (uint32_t done = 0, n; done < len; done += n, counters += n) {
+        int s = counters % SLICE_LANES;
+        n = SLICE_LANES - s < len - done ? SLICE_LANES - s : len - done;
+        uint64_t mask = lanes_mask(n) << s;
+
+        const uint64_t *w = slice_block(counters);
+        for (int i = 0; i < SLICE_BITS; i++) {
+            if (w[i] & mask) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Single counters are cheaper to add one bit at a time than through the adder network
+
+inline void _add_mod(counter_ptr_t dest, counter_ptr_t src, counter_t mod) {
+    track(slice_one(dest, src, mod, SLICE_ADD));
+}
+
+inline void _add_mod_reset(counter_ptr_t dest, counter_ptr_t src, counter_t mod) {
+    track(slice_one(dest, src, mod, SLICE_RESET));
+}
+
+inline void _add_mod_twice(counter_ptr_t dest, counter_ptr_t dest_new, counter_ptr_t src,
+                           counter_t mod) {
+    _add_mod(dest_new, dest, mod);
+    _add_mod_reset(dest, src, mod);
+}
+
+inline void _add_mod_set_src(counter_ptr_t dest, counter_ptr_t src, counter_t mod) {
+    track(slice_one(dest, src, mod, SLICE_SET_SRC));
+}
+
+inline void add_mod_twice(uint32_t len, counter_ptr_t dest, counter_ptr_t dest_new,
+                          counter_ptr_t src, counter_t mod) {
+    slice_range(len, dest_new, dest, mod, SLICE_ADD);
+    slice_range(len, dest, src, mod, SLICE_RESET);
+}
+
+inline void add_mod_set_src(uint32_t len, counter_ptr_t dest, counter_ptr_t src, counter_t mod) {
+    slice_range(len, dest, src, mod, SLICE_SET_SRC);
+}
+
+inline void add_mod_reset(uint32_t len, counter_ptr_t dest, counter_ptr_t src, counter_t mod) {
+    slice_range(len, dest, src, mod, SLICE_RESET);
+}
+
+inline void add_mod(uint32_t len, counter_ptr_t dest, counter_ptr_t src, counter_t mod) {
+    slice_range(len, dest, src, mod, SLICE_ADD);
+}
@@ -0,0 +1,150 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+#include "defs.h"
+#include "report.h"
+#include "stats.h"
+
+#define RELAXED memory_order_relaxed
+
+// Start of the counting and of the current cell in this process, forked jobs keep their own
+uint64_t count_start_ns = 0, cell_start_ns = 0, cell_start_states = 0;
+
+// The kernels add the states of the buckets they don't skip as zero, see process_group_tasks
+__thread uint64_t t_states_done = 0;
+
+uint64_t resident_size() {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t cnt = MACH_TASK_BASIC_INFO_COUNT;
+    int ok = task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &cnt) ==
+             KERN_SUCCESS;
+    return ok ? info.resident_size : 0;
+#else
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        uint64_t size, resident;
+        int ok = fscanf(f, "%" SCNu64 " %" SCNu64, &size, &resident) == 2;
+        fclose(f);
+        if (ok) {
+            return resident * sysconf(_SC_PAGESIZE);
+        }
+    }
+
+    // Without /proc only the peak is known, in kilobytes on Linux and the BSDs
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+uint64_t states_done(stats_t *stats) {
+    uint64_t states = 0;
+    for (int t = 0; t < STATS_THREADS; t++) {
+        states += atomic_load_explicit(&stats->thread_states[t], RELAXED);
+    }
+    return states;
+}
+
+stats_t *open_stats(const char *path, int threads) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(stats_t)) != 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    // Shared with the forked jobs as well as with the readers
+    stats_t *stats = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (stats == MAP_FAILED) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    stats->version = STATS_VERSION;
+    stats->pid = getpid();
+    stats->n = N;
+    stats->bits = COUNTER_BITS;
+    stats->threads = threads;
+    strcpy(stats->mode, HAMILTONIAN ? "hamiltonian" : CYCLES ? "cycles" : "paths");
+    stats->start_ns = realtime_ns();
+    atomic_store_explicit(&stats->updated_ns, stats->start_ns, RELAXED);
+    atomic_store_explicit(&stats->rss, resident_size(), RELAXED);
+
+    // A reader that sees the magic sees the fixed fields as well
+    atomic_thread_fence(memory_order_release);
+    stats->magic = STATS_MAGIC;
+    return stats;
+}
+
+void expect_runs(stats_t *stats, int runs) {
+    if (stats) {
+        atomic_fetch_add_explicit(&stats->cells_total, (uint64_t)runs * N * (N - 1), RELAXED);
+    }
+}
+
+void start_cell(stats_t *stats, int row, int col) {
+    if (stats) {
+        atomic_store_explicit(&stats->row, row, RELAXED);
+        atomic_store_explicit(&stats->col, col, RELAXED);
+        cell_start_ns = realtime_ns();
+        cell_start_states = states_done(stats);
+        if (count_start_ns == 0) {
+            count_start_ns = cell_start_ns;
+        }
+    }
+}
+
+void finish_cell(stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    uint64_t now = realtime_ns();
+    uint64_t done = atomic_fetch_add_explicit(&stats->cells_done, 1, RELAXED) + 1;
+    uint64_t total = atomic_load_explicit(&stats->cells_total, RELAXED);
+
+    // The rate covers only the last cell, so a node that slows down shows it right away
+    if (now > cell_start_ns) {
+        uint64_t states = states_done(stats) - cell_start_states;
+        atomic_store_explicit(&stats->states_per_sec,
+                              (uint64_t)(states * 1e9 / (now - cell_start_ns)), RELAXED);
+    }
+    if (total > done) {
+        // Building the tables is left out, it doesn't scale with the cells
+        double elapsed = (now - count_start_ns) * 1e-9;
+        atomic_store_explicit(&stats->eta, (uint64_t)(elapsed * (total - done) / done), RELAXED);
+    } else {
+        atomic_store_explicit(&stats->eta, 0, RELAXED);
+    }
+    atomic_store_explicit(&stats->rss, resident_size(), RELAXED);
+    atomic_store_explicit(&stats->updated_ns, now, RELAXED);
+}
+
+void add_states(stats_t *stats, int thread, uint64_t states) {
+    atomic_fetch_add_explicit(&stats->thread_states[thread % STATS_THREADS], states, RELAXED);
+}
+
+void finish_stats(stats_t *stats) {
+    if (stats) {
+        atomic_store_explicit(&stats->updated_ns, realtime_ns(), RELAXED);
+        atomic_store_explicit(&stats->finished, 1, RELAXED);
+    }
+}
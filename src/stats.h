@@ -0,0 +1,47 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// The layout doesn't depend on N or BITS, so path-counter-top reads the file of any build
+#define STATS_MAGIC 0x54534350U
+#define STATS_VERSION 1
+#define STATS_THREADS 64
+
+// Live state of a run in a shared file. Workers and the counting thread only do relaxed stores
+// and adds, a reader may see the fields of one cell at slightly different moments.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    int32_t n;
+    int32_t bits;
+    int32_t threads;
+    char mode[16];
+    uint64_t start_ns;
+
+    _Atomic int32_t row;
+    _Atomic int32_t col;
+    _Atomic int32_t finished;
+    _Atomic uint64_t cells_done;
+    _Atomic uint64_t cells_total;
+    _Atomic uint64_t states_per_sec;
+    _Atomic uint64_t rss;
+    _Atomic uint64_t eta;
+    _Atomic uint64_t updated_ns;
+
+    // Non-zero states processed by every worker thread, threads beyond STATS_THREADS share the
+    // slots
+    _Atomic uint64_t thread_states[STATS_THREADS];
+} stats_t;
+
+stats_t *open_stats(const char *, int);
+void expect_runs(stats_t *, int);
+void start_cell(stats_t *, int, int);
+void finish_cell(stats_t *);
+void add_states(stats_t *, int, uint64_t);
+void finish_stats(stats_t *);
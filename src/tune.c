@@ -0,0 +1,156 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+#include "tune.h"
+
+#define PROFILE_LINE 256
+#define PROFILE_LINES 4096
+
+const char *order_names[ORDER_CNT] = {"descending", "ascending", "largest"};
+
+const char *profile_path() {
+    static char path[PROFILE_LINE];
+
+    const char *env = getenv(PROFILE_ENV);
+    if (env != NULL && env[0] != '\0') {
+        return env;
+    }
+
+    // One file per user, its entries are keyed by the host, so a shared home directory works
+    const char *home = getenv("HOME");
+    if (home == NULL || home[0] == '\0') {
+        return PROFILE_FILE;
+    }
+    snprintf(path, sizeof(path), "%s/%s", home, PROFILE_FILE);
+    return path;
+}
+
+const char *order_name(int order) {
+    return order_names[order];
+}
+
+void cpu_model(char *model, size_t size) {
+    snprintf(model, size, "unknown");
+
+#ifdef __APPLE__
+    sysctlbyname("machdep.cpu.brand_string", model, &size, NULL, 0);
+#else
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL) {
+        return;
+    }
+
+    char line[PROFILE_LINE];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *value = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && value != NULL) {
+            value += strspn(value, ": \t");
+            value[strcspn(value, "\n")] = '\0';
+            snprintf(model, size, "%s", value);
+            break;
+        }
+    }
+    fclose(f);
+#endif
+}
+
+// A tuning only holds for the counter width, the mode and the machine it was measured on. The
+// cost per state and the best thread setting barely move with N, so every N shares the entry.
+void profile_key(char *key, size_t size) {
+    char host[64] = "unknown", model[128];
+    gethostname(host, sizeof(host) - 1);
+    cpu_model(model, sizeof(model));
+
+    snprintf(key, size, "[bits=%d mode=%s host=%s cpu=%s]", COUNTER_BITS,
+             HAMILTONIAN ? "hamiltonian" : CYCLES ? "cycles" : "paths", host, model);
+}
+
+int load_profile(const char *path, tuning_t *tuning) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+
+    char key[PROFILE_LINE];
+    profile_key(key, sizeof(key));
+
+    // Only the entry of this counter width, mode and machine is read. Unknown keys and malformed lines are
+    // skipped, so older binaries can read newer profiles.
+    char line[PROFILE_LINE], value[64];
+    int matches = 0, found = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int threads;
+        double ns_per_state;
+
+        if (line[0] == '[') {
+            line[strcspn(line, "\n")] = '\0';
+            matches = strcmp(line, key) == 0;
+            found |= matches;
+        } else if (!matches) {
+            continue;
+        } else if (sscanf(line, "threads = %d", &threads) == 1 && threads > 0) {
+            tuning->threads = threads;
+        } else if (sscanf(line, "ns/state = %lf", &ns_per_state) == 1 && ns_per_state > 0) {
+            tuning->ns_per_state = ns_per_state;
+        } else if (sscanf(line, "order = %63s", value) == 1) {
+            for (int i = 0; i < ORDER_CNT; i++) {
+                if (strcmp(value, order_names[i]) == 0) {
+                    tuning->order = i;
+                }
+            }
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+// Replaces the entry of this counter width, mode and machine, the entries of other ones are kept
+int save_profile(const char *path, const tuning_t *tuning) {
+    char key[PROFILE_LINE];
+    profile_key(key, sizeof(key));
+
+    static char lines[PROFILE_LINES][PROFILE_LINE];
+    int lines_cnt = 0;
+
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        char line[PROFILE_LINE];
+        int keep = 0;
+        while (fgets(line, sizeof(line), f) != NULL && lines_cnt < PROFILE_LINES) {
+            if (line[0] == '[') {
+                keep = strncmp(line, key, strlen(key)) != 0 || line[strlen(key)] != '\n';
+            }
+            if (keep) {
+                snprintf(lines[lines_cnt++], PROFILE_LINE, "%s", line);
+            }
+        }
+        fclose(f);
+    }
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        return 0;
+    }
+
+    for (int i = 0; i < lines_cnt; i++) {
+        fputs(lines[i], f);
+    }
+    fprintf(f, "%s\n", key);
+    fprintf(f, "threads = %d\n", tuning->threads);
+    fprintf(f, "order = %s\n", order_names[tuning->order]);
+    fprintf(f, "ns/state = %.3f\n", tuning->ns_per_state);
+
+    return fclose(f) == 0;
+}
@@ -0,0 +1,30 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include "defs.h"
+
+#define PROFILE_ENV "PATH_COUNTER_PROFILE"
+#define PROFILE_FILE ".path-counter.profile"
+
+// Every setting is timed at least TUNE_MIN_RUNS times and for TUNE_MIN_SECONDS, its fastest run
+// counts
+#define TUNE_MIN_RUNS 3
+#define TUNE_MIN_SECONDS 1.0
+
+// Order in which the groups of a cell are queued for the threads
+enum { ORDER_DESCENDING, ORDER_ASCENDING, ORDER_LARGEST, ORDER_CNT };
+
+typedef struct {
+    int threads;
+    int order;
+    double ns_per_state;
+} tuning_t;
+
+const char *profile_path();
+const char *order_name(int);
+
+int load_profile(const char *, tuning_t *);
+int save_profile(const char *, const tuning_t *);
@@ -0,0 +1,186 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "inline.h"
+#include "report.h"
+#include "verify.h"
+
+// Every counter write adds (new - old) here, so the per-cell totals of all threads track the sum
+// of the counters. A bit flipped in a counter at rest changes that sum. The change is computed from
+// the values an update loaded, so a value read wrong and written back goes into both sums and is
+// not detected.
+__thread uint64_t t_checksum_delta = 0;
+
+#if SLICE_BITS
+
+uint64_t checksum(const uint64_t *slices) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < g_slices_cnt; i++) {
+        sum += (uint64_t)__builtin_popcountll(slices[i]) << (i % SLICE_BITS);
+    }
+    return sum;
+}
+
+uint64_t counters_checksum(const grid_context_t *context) {
+    return checksum(g_slices);
+}
+
+// All bit planes are saved and restored as one region
+int counter_regions(const grid_context_t *context, void **ptrs, uint64_t *sizes) {
+    ptrs[0] = g_slices;
+    sizes[0] = g_slices_cnt * sizeof(uint64_t);
+    return 1;
+}
+
+#else
+
+uint64_t checksum(const counter_t *counters, uint64_t cnt) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < cnt; i++) {
+        sum += counters[i];
+    }
+    return sum;
+}
+
+uint64_t counters_checksum(const grid_context_t *context) {
+    return checksum(context->main, context->counters_cnt) +
+           checksum(context->blocked, context->blocked_cnt);
+}
+
+int counter_regions(const grid_context_t *context, void **ptrs, uint64_t *sizes) {
+    ptrs[0] = context->main;
+    sizes[0] = context->counters_cnt * sizeof(counter_t);
+    ptrs[1] = context->blocked;
+    sizes[1] = context->blocked_cnt * sizeof(counter_t);
+    return 2;
+}
+
+#endif
+
+// The copy doubles the memory of the counters, so without a file it is only kept when it fits.
+// rows is the number of rows between copies, 0 for none.
+snapshot_t *open_snapshot(const grid_context_t *context, const char *path, int rows) {
+    snapshot_t *snapshot = calloc(1, sizeof(snapshot_t));
+    if (snapshot == NULL) {
+        fprintf(stderr, "memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    snapshot->rows = rows;
+    snapshot->path = path;
+
+    void *ptrs[2];
+    uint64_t sizes[2], size = 0;
+    int regions_cnt = counter_regions(context, ptrs, sizes);
+    for (int i = 0; i < regions_cnt; i++) {
+        size += sizes[i];
+    }
+
+    if (rows && path == NULL) {
+        if (size <= available_memory()) {
+            snapshot->copy = malloc(size);
+        }
+        if (snapshot->copy == NULL) {
+            snapshot->rows = 0;
+        }
+    }
+
+    if (snapshot->copy) {
+        printf("snapshot = memory, %" PRIu64 "MB every %d row%s\n", MB(size), rows, rows > 1 ? "s" : "");
+    } else if (snapshot->rows) {
+        printf("snapshot = %s, %" PRIu64 "MB every %d row%s\n", path, MB(size), rows,
+               rows > 1 ? "s" : "");
+    } else {
+        printf("snapshot = none%s, a mismatch stops the run\n",
+               rows ? " (doesn't fit in memory)" : "");
+    }
+    return snapshot;
+}
+
+// Copies are taken before the first row and after every rows rows, the last row doesn't need one
+int is_snapshot_row(const snapshot_t *snapshot, int row) {
+    return snapshot->rows && (row + 1) % snapshot->rows == 0 && row < N - 1;
+}
+
+// A new file replaces the old one only when it's complete
+void write_snapshot(const char *path, void *const *ptrs, const uint64_t *sizes, int regions_cnt) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+
+    FILE *f = fopen(tmp_path, "wb");
+    int ok = f != NULL;
+    for (int i = 0; i < regions_cnt && ok; i++) {
+        ok = fwrite(ptrs[i], 1, sizes[i], f) == sizes[i];
+    }
+    if (f == NULL || fclose(f) != 0 || !ok || rename(tmp_path, path) != 0) {
+        perror(path);
+        unlink(tmp_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int read_snapshot(const char *path, void *const *ptrs, const uint64_t *sizes, int regions_cnt) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+
+    int ok = 1;
+    for (int i = 0; i < regions_cnt && ok; i++) {
+        ok = fread(ptrs[i], 1, sizes[i], f) == sizes[i];
+    }
+    fclose(f);
+    return ok;
+}
+
+void save_snapshot(const grid_context_t *context, snapshot_t *snapshot, int row, uint64_t count,
+                   uint64_t sum) {
+    void *ptrs[2];
+    uint64_t sizes[2];
+    int regions_cnt = counter_regions(context, ptrs, sizes);
+
+    if (snapshot->copy) {
+        uint8_t *copy = snapshot->copy;
+        for (int i = 0; i < regions_cnt; i++) {
+            memcpy(copy, ptrs[i], sizes[i]);
+            copy += sizes[i];
+        }
+    } else {
+        write_snapshot(snapshot->path, ptrs, sizes, regions_cnt);
+    }
+
+    snapshot->row = row;
+    snapshot->count = count;
+    snapshot->checksum = sum;
+}
+
+int restore_snapshot(const grid_context_t *context, const snapshot_t *snapshot) {
+    if (!snapshot->rows) {
+        return 0;
+    }
+
+    void *ptrs[2];
+    uint64_t sizes[2];
+    int regions_cnt = counter_regions(context, ptrs, sizes);
+
+    if (snapshot->copy) {
+        const uint8_t *copy = snapshot->copy;
+        for (int i = 0; i < regions_cnt; i++) {
+            memcpy(ptrs[i], copy, sizes[i]);
+            copy += sizes[i];
+        }
+    } else if (!read_snapshot(snapshot->path, ptrs, sizes, regions_cnt)) {
+        return 0;
+    }
+
+    // The copy can be hit just like the counters, so it's only trusted when its sum matches
+    return counters_checksum(context) == snapshot->checksum;
+}
@@ -0,0 +1,28 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include "defs.h"
+
+// Rollbacks allowed for a single row before the run is given up
+#define VERIFY_RETRIES 3
+
+// Counters as they were after the last saved row, in memory or in a file. Without a copy, rows is
+// 0 and a mismatch stops the run.
+typedef struct {
+    int row;
+    uint64_t count;
+    uint64_t checksum;
+
+    int rows;
+    void *copy;
+    const char *path;
+} snapshot_t;
+
+uint64_t counters_checksum(const grid_context_t *);
+snapshot_t *open_snapshot(const grid_context_t *, const char *, int);
+int is_snapshot_row(const snapshot_t *, int);
+void save_snapshot(const grid_context_t *, snapshot_t *, int, uint64_t, uint64_t);
+int restore_snapshot(const grid_context_t *, const snapshot_t *);
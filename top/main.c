@@ -0,0 +1,151 @@
+/*
+  Copyright (c) 2024 Milos Tatarevic
+
+  This file is part of the FastGridPathCounter repository.
+*/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "report.h"
+#include "stats.h"
+
+#define RELAXED memory_order_relaxed
+
+// A run that didn't update its stats for this long is flagged, its node may be stuck
+#define STALE_SECONDS 60
+
+const stats_t *map_stats(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    const stats_t *stats = mmap(NULL, sizeof(stats_t), PROT_READ, MAP_SHARED, fd, 0);
+    if (stats == MAP_FAILED) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    if (stats->magic != STATS_MAGIC || stats->version != STATS_VERSION) {
+        fprintf(stderr, "%s is not a path-counter stats file\n", path);
+        exit(EXIT_FAILURE);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return stats;
+}
+
+// Returns 1 while the run is still going
+int print_stats(const stats_t *stats) {
+    uint64_t now = realtime_ns();
+    int finished = atomic_load_explicit(&stats->finished, RELAXED);
+    int alive = kill(stats->pid, 0) == 0;
+
+    uint64_t cells_done = atomic_load_explicit(&stats->cells_done, RELAXED);
+    uint64_t cells_total = atomic_load_explicit(&stats->cells_total, RELAXED);
+    uint64_t updated_ns = atomic_load_explicit(&stats->updated_ns, RELAXED);
+    double idle = updated_ns < now ? (now - updated_ns) * 1e-9 : 0;
+
+    printf("pid      = %d (%s)\n", stats->pid,
+           finished ? "finished" : !alive ? "gone" : idle > STALE_SECONDS ? "stale" : "running");
+    printf("config   = N=%d, %d bits, %s, %d threads\n", stats->n, stats->bits, stats->mode,
+           stats->threads);
+    printf("position = row %d, col %d\n", atomic_load_explicit(&stats->row, RELAXED) + 1,
+           atomic_load_explicit(&stats->col, RELAXED));
+    printf("cells    = %" PRIu64 "/%" PRIu64 "", cells_done, cells_total);
+    if (cells_total > 0) {
+        printf(" (%.1f%%)", 100.0 * cells_done / cells_total);
+    }
+    printf("\n");
+    printf("rate     = %.2fM states/s\n",
+           atomic_load_explicit(&stats->states_per_sec, RELAXED) * 1e-6);
+    printf("rss      = %" PRIu64 "MB\n", MB(atomic_load_explicit(&stats->rss, RELAXED)));
+
+    printf("elapsed  = ");
+    print_duration(((finished ? updated_ns : now) - stats->start_ns) * 1e-9);
+    printf("\neta      = ");
+    if (finished) {
+        printf("done");
+    } else if (cells_done == 0) {
+        printf("unknown");
+    } else {
+        print_duration(atomic_load_explicit(&stats->eta, RELAXED));
+    }
+    printf("\nupdated  = ");
+    print_duration(idle);
+    printf(" ago\n\n");
+
+    // Slots past the configured threads are only used by builds with more than STATS_THREADS
+    uint64_t states[STATS_THREADS], total = 0;
+    for (int t = 0; t < STATS_THREADS; t++) {
+        states[t] = atomic_load_explicit(&stats->thread_states[t], RELAXED);
+        total += states[t];
+    }
+    printf("thread           states   share\n");
+    for (int t = 0; t < STATS_THREADS; t++) {
+        if (states[t] > 0 || t < stats->threads) {
+            printf("%6d  %15" PRIu64 "  %5.1f%%\n", t, states[t], total ? 100.0 * states[t] / total : 0);
+        }
+    }
+    return !finished && alive;
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--once] [--interval <seconds>] <stats file>\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"once", no_argument, NULL, 'o'},
+        {"interval", required_argument, NULL, 'i'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int once = 0, interval = 2;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "oi:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'o':
+            once = 1;
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            if (interval < 1) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+
+    const stats_t *stats = map_stats(argv[optind]);
+    if (once) {
+        print_stats(stats);
+        return 0;
+    }
+
+    // Redraws in place until the run finishes or its process is gone
+    while (1) {
+        printf("\033[H\033[J");
+        int running = print_stats(stats);
+        fflush(stdout);
+        if (!running) {
+            break;
+        }
+        sleep(interval);
+    }
+    return 0;
+}